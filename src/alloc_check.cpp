@@ -0,0 +1,226 @@
+#include <glm/glm.hpp>
+#include <atomic>
+#include <new>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "rendering/renderer.h"
+
+#include "models/scenes.h"
+
+// Checks that once the first frame has been rendered, e.g. so the pools of
+// scratch buffers have grown, rendering a frame makes no heap allocations.
+// Every call to operator new is counted, and each renderer is run on each
+// scene. Exits with a non-zero code if any frame after the first allocates.
+//
+//   ./bin/alloc_check [--width N] [--height N] [--frames N] [--scenes a,b,c]
+//                     [--mesh PATH]
+
+using std::string;
+using std::vector;
+
+// The number of calls to operator new, by any thread.
+static std::atomic<long> num_allocations(0);
+
+void *operator new(size_t size) {
+    num_allocations++;
+    void *p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    num_allocations++;
+    // aligned_alloc needs the size to be a multiple of the alignment.
+    const size_t alignment = (size_t)align;
+    void *p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+// Not inlined, so the compiler does not warn that memory from operator new
+// is released with free.
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+struct CheckOptions {
+    int width = 96;
+    int height = 80;
+    // The frames checked after the first.
+    int frames = 3;
+    int shadow_rays = 2;
+    int bounces = 5;
+    // The names of the scenes to render, or empty for every scene which does
+    // not need a file, and the mesh scene if mesh_path is given.
+    vector<string> scenes;
+    // The OBJ or PLY file for the mesh scene, which is needed to render it.
+    const char *mesh_path = nullptr;
+};
+
+// return: the number of allocations made by frames after the first, of
+//         which there should be none.
+template<typename F>
+long allocations_after_first_frame(const CheckOptions &options, F render_frame) {
+    render_frame();
+
+    const long before = num_allocations.load();
+    for (int f=0; f<options.frames; f++) {
+        render_frame();
+    }
+    return num_allocations.load() - before;
+}
+
+// return: the number of renderers which allocated while rendering the scene.
+int check_scene(const scenes::NamedScene &named, const CheckOptions &options) {
+    Scene scene = named.make(options.mesh_path);
+    Camera camera = Camera(vec4(0, 0, -2.3, 1), options.width / 2, options.bounces);
+
+    screen image;
+    memset(&image, 0, sizeof(image));
+    image.width = options.width;
+    image.height = options.height;
+    image.buffer = new uint32_t[options.width * options.height];
+
+    Accumulator accumulator = Accumulator(options.width, options.height);
+
+    int num_failures = 0;
+    auto check = [&](const char *renderer, long allocations) {
+        printf("%-14s %-12s %6ld allocations%s\n", named.name, renderer, allocations, allocations > 0 ? "  FAIL" : "");
+        num_failures += allocations > 0;
+    };
+
+    check("render", allocations_after_first_frame(options, [&]() {
+        render(scene, camera, &image, 1, options.shadow_rays);
+    }));
+    check("render x4", allocations_after_first_frame(options, [&]() {
+        render(scene, camera, &image, 4, options.shadow_rays);
+    }));
+    check("packets", allocations_after_first_frame(options, [&]() {
+        render_packets(scene, camera, &image, options.shadow_rays);
+    }));
+    check("wavefront", allocations_after_first_frame(options, [&]() {
+        render_wavefront(scene, camera, &image, options.shadow_rays);
+    }));
+    check("progressive", allocations_after_first_frame(options, [&]() {
+        render_progressive(scene, camera, &image, accumulator, 1, options.shadow_rays);
+    }));
+    check("adaptive", allocations_after_first_frame(options, [&]() {
+        render_adaptive(scene, camera, &image, 4, 16, 0.01f, options.shadow_rays);
+    }));
+
+    delete[] image.buffer;
+    return num_failures;
+}
+
+// param options: set from the arguments.
+// return: whether the arguments were valid.
+bool parse(int argc, char *argv[], CheckOptions &options) {
+    for (int i=1; i<argc; i++) {
+        const string arg = argv[i];
+        if (i + 1 == argc) {
+            printf("Missing value for %s\n", argv[i]);
+            return false;
+        }
+        const char *value = argv[++i];
+
+        if (arg == "--width") {
+            options.width = atoi(value);
+        } else if (arg == "--height") {
+            options.height = atoi(value);
+        } else if (arg == "--frames") {
+            options.frames = atoi(value);
+        } else if (arg == "--scenes") {
+            std::stringstream names(value);
+            string name;
+            while (std::getline(names, name, ',')) {
+                if (scenes::find(name.c_str()) == nullptr) {
+                    printf("Unknown scene: %s\n", name.c_str());
+                    return false;
+                }
+                options.scenes.push_back(name);
+            }
+        } else if (arg == "--mesh") {
+            options.mesh_path = value;
+        } else {
+            printf("Unknown option: %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0) {
+        printf("Sizes and counts must be positive\n");
+        return false;
+    }
+    if (options.mesh_path == nullptr && std::find(options.scenes.begin(), options.scenes.end(), "mesh") != options.scenes.end()) {
+        printf("The mesh scene needs --mesh PATH\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    CheckOptions options;
+    if (!parse(argc, argv, options)) {
+        printf("usage: %s [--width N] [--height N] [--frames N] [--scenes a,b,c] [--mesh PATH]\n", argv[0]);
+        return 1;
+    }
+
+    int num_failures = 0;
+    for (int i=0; i<scenes::num_scenes; i++) {
+        const scenes::NamedScene &named = scenes::all[i];
+        const bool chosen = options.scenes.empty()
+            ? strcmp(named.name, "mesh") != 0 || options.mesh_path != nullptr
+            : std::find(options.scenes.begin(), options.scenes.end(), named.name) != options.scenes.end();
+        if (chosen) {
+            num_failures += check_scene(named, options);
+        }
+    }
+
+    printf("%d renderer%s allocated after the first frame\n", num_failures, num_failures == 1 ? "" : "s");
+    return num_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,394 @@
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "geometry/primitives/triangle.h"
+#include "geometry/primitives/sphere.h"
+#include "geometry/object.h"
+#include "geometry/ray_stats.h"
+#include "lights/point_light.h"
+#include "lights/directional_light.h"
+#include "lights/ambient_light.h"
+#include "shaders/diffuse.h"
+#include "shaders/blinn.h"
+#include "shaders/mirror.h"
+#include "shaders/mix.h"
+#include "shaders/refraction.h"
+#include "shaders/fresnel.h"
+#include "shaders/glass.h"
+#include "shaders/flat_color.h"
+#include "shaders/smoke.h"
+#include "shaders/projection.h"
+#include "rendering/renderer.h"
+
+#include "models/scenes.h"
+
+// Renders each of the models from a fixed camera, with 1 up to N threads,
+// and writes the time per frame and rays per second as JSON. Two runs can
+// be compared to find regressions.
+//
+//   ./bin/benchmark [--width N] [--height N] [--frames N] [--threads N]
+//                   [--scenes a,b,c] [--mesh PATH] [--out FILE]
+//   ./bin/benchmark --compare BASE.json NEW.json [--threshold PERCENT]
+
+using std::string;
+using std::vector;
+
+// The measurements of one scene rendered with a number of threads.
+struct BenchResult {
+    string scene;
+    int threads;
+    // The median and fastest time to render a frame.
+    double ms_per_frame;
+    double min_ms;
+    // Rays from the camera, and all other rays traced through the scene,
+    // e.g. shadow, reflected, and volume rays, in millions per second.
+    double primary_mrays_per_s;
+    double secondary_mrays_per_s;
+    // The speed up over rendering with one thread.
+    double scaling;
+    // The work done for one frame, which only includes more than the number
+    // of rays when compiled with RAY_STATS.
+    FrameStats stats;
+};
+
+struct BenchOptions {
+    int width = 320;
+    int height = 256;
+    int frames = 5;
+    int max_threads = omp_get_num_procs();
+    int shadow_rays = 1;
+    int bounces = 5;
+    // The names of the scenes to render, or empty for every scene which does
+    // not need a file, and the mesh scene if mesh_path is given.
+    vector<string> scenes;
+    // The OBJ or PLY file for the mesh scene, which is needed to render it.
+    const char *mesh_path = nullptr;
+    const char *out = nullptr;
+};
+
+// return: the numbers of threads to measure with, doubling from one up to
+//         max_threads, which is always included.
+vector<int> thread_counts(int max_threads) {
+    vector<int> counts;
+    for (int t=1; t<max_threads; t*=2) {
+        counts.push_back(t);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+// return: the time taken to render each of the frames, in milliseconds,
+//         sorted from fastest to slowest.
+// param stats: set to the work done for all the frames.
+vector<double> time_frames(Scene &scene, Camera &camera, screen *screen, const BenchOptions &options, FrameStats &stats) {
+    vector<double> times;
+    RayStats::reset();
+
+    for (int f=0; f<options.frames; f++) {
+        // The same random shadow rays are used each run, as far as the
+        // order the threads take them allows.
+        srand(f);
+        auto start = std::chrono::steady_clock::now();
+        render_packets(scene, camera, screen, options.shadow_rays);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        times.push_back(elapsed.count());
+    }
+
+    stats = RayStats::total();
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+// effect: renders the scene with each number of threads, adding the
+//         measurements to results.
+void bench_scene(const scenes::NamedScene &named, const BenchOptions &options, vector<BenchResult> &results) {
+    Scene scene = named.make(options.mesh_path);
+    Camera camera = Camera(vec4(0, 0, -2.3, 1), options.width / 2, options.bounces);
+
+    screen image;
+    memset(&image, 0, sizeof(image));
+    image.width = options.width;
+    image.height = options.height;
+    image.buffer = new uint32_t[options.width * options.height];
+
+    // Warm up, e.g. so textures are in the cache and the pools of scratch
+    // buffers have grown.
+    render_packets(scene, camera, &image, options.shadow_rays);
+
+    double single_thread_ms = 0.0;
+    for (int threads: thread_counts(options.max_threads)) {
+        omp_set_num_threads(threads);
+
+        FrameStats stats;
+        vector<double> times = time_frames(scene, camera, &image, options, stats);
+
+        double total_ms = 0.0;
+        for (double ms: times) {
+            total_ms += ms;
+        }
+
+        BenchResult result;
+        result.scene = named.name;
+        result.threads = threads;
+        result.ms_per_frame = times[times.size() / 2];
+        result.min_ms = times[0];
+
+        // Packets trace exactly one primary ray per pixel.
+        const long primary_rays = (long)options.width * options.height * options.frames;
+        result.primary_mrays_per_s = primary_rays / total_ms / 1000.0;
+        result.secondary_mrays_per_s = (stats.rays - primary_rays) / total_ms / 1000.0;
+
+        // The counts are the same for any number of threads, apart from the
+        // random shadow rays, so are given per frame.
+        result.stats = stats;
+        result.stats.rays /= options.frames;
+        for (int s=0; s<num_ray_stats; s++) {
+            result.stats.counts[s] /= options.frames;
+        }
+        for (int b=0; b<max_stat_bounces; b++) {
+            result.stats.bounces[b] /= options.frames;
+        }
+
+        if (threads == 1) {
+            single_thread_ms = result.ms_per_frame;
+        }
+        result.scaling = single_thread_ms / result.ms_per_frame;
+
+        fprintf(stderr, "%-14s %3d threads %9.2f ms/frame %8.2f primary %8.2f secondary Mrays/s  x%.2f\n",
+                result.scene.c_str(), threads, result.ms_per_frame, result.primary_mrays_per_s,
+                result.secondary_mrays_per_s, result.scaling);
+        results.push_back(result);
+    }
+
+    delete[] image.buffer;
+}
+
+// effect: writes the results as JSON, one result per line so runs can be
+//         compared with diff as well as read by other tools.
+void write_json(std::ostream &out, const BenchOptions &options, const vector<BenchResult> &results) {
+    char line[512];
+
+    out << "{\n";
+    out << "  \"width\": " << options.width << ",\n";
+    out << "  \"height\": " << options.height << ",\n";
+    out << "  \"frames\": " << options.frames << ",\n";
+    out << "  \"shadow_rays\": " << options.shadow_rays << ",\n";
+    out << "  \"bounces\": " << options.bounces << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i=0; i<results.size(); i++) {
+        const BenchResult &r = results[i];
+        snprintf(line, sizeof(line),
+                 "    {\"scene\": \"%s\", \"threads\": %d, \"ms_per_frame\": %.3f, \"min_ms\": %.3f, "
+                 "\"primary_mrays_per_s\": %.3f, \"secondary_mrays_per_s\": %.3f, \"scaling\": %.3f, \"per_frame\": ",
+                 r.scene.c_str(), r.threads, r.ms_per_frame, r.min_ms, r.primary_mrays_per_s,
+                 r.secondary_mrays_per_s, r.scaling);
+        out << line;
+        r.stats.write_json(out);
+        out << "}" << (i + 1 == results.size() ? "" : ",") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// return: the number following "key": in the line, or zero if there is none.
+double json_number(const string &line, const char *key) {
+    const string quoted = string("\"") + key + "\":";
+    const size_t pos = line.find(quoted);
+    return pos == string::npos ? 0.0 : atof(line.c_str() + pos + quoted.size());
+}
+
+// return: the string following "key": in the line, or an empty string if
+//         there is none.
+string json_string(const string &line, const char *key) {
+    const string quoted = string("\"") + key + "\": \"";
+    const size_t start = line.find(quoted);
+    if (start == string::npos) {
+        return "";
+    }
+    const size_t end = line.find('"', start + quoted.size());
+    return line.substr(start + quoted.size(), end - start - quoted.size());
+}
+
+// return: the results in a file written by write_json.
+vector<BenchResult> read_json(const char *path) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Unable to read benchmark results: %s\n", path);
+        exit(1);
+    }
+
+    vector<BenchResult> results;
+    string line;
+    while (std::getline(file, line)) {
+        if (line.find("\"scene\"") == string::npos) {
+            continue;
+        }
+
+        BenchResult result;
+        result.scene = json_string(line, "scene");
+        result.threads = (int)json_number(line, "threads");
+        result.ms_per_frame = json_number(line, "ms_per_frame");
+        result.min_ms = json_number(line, "min_ms");
+        result.primary_mrays_per_s = json_number(line, "primary_mrays_per_s");
+        result.secondary_mrays_per_s = json_number(line, "secondary_mrays_per_s");
+        result.scaling = json_number(line, "scaling");
+        results.push_back(result);
+    }
+    return results;
+}
+
+// return: the result for the same scene and number of threads as r, or
+//         nullptr if there is none.
+const BenchResult *find_result(const vector<BenchResult> &results, const BenchResult &r) {
+    for (const BenchResult &result: results) {
+        if (result.scene == r.scene && result.threads == r.threads) {
+            return &result;
+        }
+    }
+    return nullptr;
+}
+
+// return: the exit code, which is non-zero if any scene rendered with the
+//         same number of threads is slower in the new run by more than the
+//         threshold, as a percentage, or if a scene measured in the base run
+//         is missing from the new run, or has no time to compare against.
+int compare(const char *base_path, const char *new_path, double threshold) {
+    const vector<BenchResult> base = read_json(base_path);
+    const vector<BenchResult> current = read_json(new_path);
+
+    int num_regressions = 0;
+    // Results which cannot be compared, which are counted as failures so a
+    // broken run does not pass.
+    int num_missing = 0;
+    printf("%-14s %7s %12s %12s %9s\n", "scene", "threads", "base ms", "new ms", "change");
+    for (const BenchResult &r: current) {
+        const BenchResult *b = find_result(base, r);
+        if (b == nullptr) {
+            printf("%-14s %7d %12s %12.2f %9s\n", r.scene.c_str(), r.threads, "-", r.ms_per_frame, "new");
+            continue;
+        }
+        if (b->ms_per_frame <= 0.0) {
+            printf("%-14s %7d %12s %12.2f %9s  NO BASE TIME\n", r.scene.c_str(), r.threads, "-", r.ms_per_frame, "");
+            num_missing++;
+            continue;
+        }
+
+        const double change = 100.0 * (r.ms_per_frame - b->ms_per_frame) / b->ms_per_frame;
+        const bool regressed = change > threshold;
+        num_regressions += regressed;
+        printf("%-14s %7d %12.2f %12.2f %+8.1f%%%s\n", r.scene.c_str(), r.threads, b->ms_per_frame,
+               r.ms_per_frame, change, regressed ? "  REGRESSION" : "");
+    }
+
+    for (const BenchResult &b: base) {
+        if (find_result(current, b) == nullptr) {
+            printf("%-14s %7d %12.2f %12s %9s  MISSING\n", b.scene.c_str(), b.threads, b.ms_per_frame, "-", "");
+            num_missing++;
+        }
+    }
+
+    printf("%d regression%s over %.1f%%, %d missing\n", num_regressions, num_regressions == 1 ? "" : "s", threshold, num_missing);
+    return num_regressions + num_missing > 0 ? 1 : 0;
+}
+
+// param options: set from the arguments.
+// return: whether the arguments were valid.
+bool parse(int argc, char *argv[], BenchOptions &options) {
+    for (int i=1; i<argc; i++) {
+        const string arg = argv[i];
+        if (i + 1 == argc) {
+            printf("Missing value for %s\n", argv[i]);
+            return false;
+        }
+        const char *value = argv[++i];
+
+        if (arg == "--width") {
+            options.width = atoi(value);
+        } else if (arg == "--height") {
+            options.height = atoi(value);
+        } else if (arg == "--frames") {
+            options.frames = atoi(value);
+        } else if (arg == "--threads") {
+            options.max_threads = atoi(value);
+        } else if (arg == "--shadow-rays") {
+            options.shadow_rays = atoi(value);
+        } else if (arg == "--bounces") {
+            options.bounces = atoi(value);
+        } else if (arg == "--out") {
+            options.out = value;
+        } else if (arg == "--scenes") {
+            std::stringstream names(value);
+            string name;
+            while (std::getline(names, name, ',')) {
+                if (scenes::find(name.c_str()) == nullptr) {
+                    printf("Unknown scene: %s\n", name.c_str());
+                    return false;
+                }
+                options.scenes.push_back(name);
+            }
+        } else if (arg == "--mesh") {
+            options.mesh_path = value;
+        } else {
+            printf("Unknown option: %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0 || options.max_threads <= 0) {
+        printf("Sizes and counts must be positive\n");
+        return false;
+    }
+    if (options.mesh_path == nullptr && std::find(options.scenes.begin(), options.scenes.end(), "mesh") != options.scenes.end()) {
+        printf("The mesh scene needs --mesh PATH\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--compare") == 0) {
+        if (argc != 4 && !(argc == 6 && strcmp(argv[4], "--threshold") == 0)) {
+            printf("usage: %s --compare BASE.json NEW.json [--threshold PERCENT]\n", argv[0]);
+            return 1;
+        }
+        const double threshold = argc == 6 ? atof(argv[5]) : 5.0;
+        return compare(argv[2], argv[3], threshold);
+    }
+
+    BenchOptions options;
+    if (!parse(argc, argv, options)) {
+        printf("usage: %s [--width N] [--height N] [--frames N] [--threads N] [--shadow-rays N]\n"
+               "       [--bounces N] [--scenes a,b,c] [--mesh PATH] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    vector<BenchResult> results;
+    for (int i=0; i<scenes::num_scenes; i++) {
+        const scenes::NamedScene &named = scenes::all[i];
+        const bool chosen = options.scenes.empty()
+            ? strcmp(named.name, "mesh") != 0 || options.mesh_path != nullptr
+            : std::find(options.scenes.begin(), options.scenes.end(), named.name) != options.scenes.end();
+        if (chosen) {
+            bench_scene(named, options, results);
+        }
+    }
+
+    if (options.out != nullptr) {
+        std::ofstream out(options.out);
+        write_json(out, options, results);
+        if (!out) {
+            printf("Unable to write benchmark results: %s\n", options.out);
+            return 1;
+        }
+    } else {
+        write_json(std::cout, options, results);
+    }
+    return 0;
+}
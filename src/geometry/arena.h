@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+
+using std::vector;
+using std::unordered_map;
+
+// Storage for many instances of one type, allocated in chunks so instances
+// are contiguous in memory. Instances are never freed individually, only all
+// together when the pool is destroyed.
+class ArenaPoolBase {
+public:
+    virtual ~ArenaPoolBase() {
+    }
+};
+
+template<typename T>
+class ArenaPool: public ArenaPoolBase {
+private:
+    // Each chunk has space for twice as many instances as the one before,
+    // up to max_chunk_size, so small pools do not waste space and large
+    // pools need few allocations.
+    static constexpr int min_chunk_size = 16;
+    static constexpr int max_chunk_size = 1 << 16;
+
+    // The chunks, and the number of instances made in the last one.
+    vector<T*> chunks;
+    vector<int> chunk_sizes;
+    int last_chunk_count = 0;
+
+public:
+    ArenaPool() {
+    }
+
+    ArenaPool(const ArenaPool&) = delete;
+    ArenaPool &operator=(const ArenaPool&) = delete;
+
+    ~ArenaPool() {
+        for (size_t c=0; c<this->chunks.size(); c++) {
+            const int count = c + 1 == this->chunks.size() ? this->last_chunk_count : this->chunk_sizes[c];
+            for (int i=0; i<count; i++) {
+                this->chunks[c][i].~T();
+            }
+            std::allocator<T>().deallocate(this->chunks[c], this->chunk_sizes[c]);
+        }
+    }
+
+    // return: a new instance constructed with the arguments.
+    template<typename... Args>
+    T *make(Args&&... args) {
+        if (this->chunks.empty() || this->last_chunk_count == this->chunk_sizes.back()) {
+            const int size = this->chunks.empty() ? min_chunk_size : std::min(2 * this->chunk_sizes.back(), max_chunk_size);
+            this->chunks.push_back(std::allocator<T>().allocate(size));
+            this->chunk_sizes.push_back(size);
+            this->last_chunk_count = 0;
+        }
+
+        T *instance = &this->chunks.back()[this->last_chunk_count];
+        new (instance) T(std::forward<Args>(args)...);
+        this->last_chunk_count++;
+        return instance;
+    }
+};
+
+// Owns instances of any number of types, each stored in its own pool. Used
+// to allocate the many small parts of a scene, e.g. primitives and shaders,
+// together rather than one at a time. Everything in the arena is destroyed
+// along with it.
+class Arena {
+private:
+    unordered_map<std::type_index, ArenaPoolBase*> pools;
+
+public:
+    Arena() {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena &operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for (auto &pool: this->pools) {
+            delete pool.second;
+        }
+    }
+
+    // return: a new instance of T, constructed with the arguments, which is
+    //         owned by the arena.
+    template<typename T, typename... Args>
+    T *make(Args&&... args) {
+        return this->pool<T>().make(std::forward<Args>(args)...);
+    }
+
+private:
+    // return: the pool of instances of T, which is created if needed.
+    template<typename T>
+    ArenaPool<T> &pool() {
+        ArenaPoolBase *&pool = this->pools[std::type_index(typeid(T))];
+        if (pool == nullptr) {
+            pool = new ArenaPool<T>();
+        }
+        return *static_cast<ArenaPool<T>*>(pool);
+    }
+};
@@ -2,6 +2,8 @@
 
 #include <glm/glm.hpp>
 #include <iostream>
+#include <limits>
+#include <algorithm>
 #include "ray.h"
 
 using glm::vec4;
@@ -17,21 +19,23 @@ public:
     BoundingCube(vec4 min, vec4 max): min(min), max(max), center((max + min) * 0.5f) {
     }
 
-    // return: whether the ray intersects the object. Used to reduce the number
-    //         of ray-primitive calculations that need to be done.
-    bool does_intersect_ray(const Ray &ray) const {
-        float tx1 = (this->min.x - ray.start.x) * ray.inv_dir.x;
-        float tx2 = (this->max.x - ray.start.x) * ray.inv_dir.x;
-
-        float tmin = std::min(tx1, tx2);
-        float tmax = std::max(tx1, tx2);
-
-        float ty1 = (this->min.y - ray.start.y) * ray.inv_dir.y;
-        float ty2 = (this->max.y - ray.start.y) * ray.inv_dir.y;
-
-        tmin = std::max(tmin, std::min(ty1, ty2));
-        tmax = std::min(tmax, std::max(ty1, ty2));
-
-        return tmax >= tmin;
+    // param t_min: the start of the interval along the ray to test, in
+    //              multiples of the ray's direction.
+    // param t_max: the end of the interval along the ray to test, e.g. the
+    //              closest intersection found so far.
+    // return: whether the ray intersects the box within the interval. Used
+    //         to reduce the number of ray-primitive calculations that need to
+    //         be done.
+    bool does_intersect_ray(const Ray &ray, float t_min = 0.0f, float t_max = std::numeric_limits<float>::max()) const {
+        for (int axis=0; axis<3; axis++) {
+            float inv_dir = 1.0f / ray.dir[axis];
+            float t1 = (this->min[axis] - ray.start[axis]) * inv_dir;
+            float t2 = (this->max[axis] - ray.start[axis]) * inv_dir;
+
+            t_min = std::max(t_min, std::min(t1, t2));
+            t_max = std::min(t_max, std::max(t1, t2));
+        }
+
+        return t_min <= t_max;
     }
 };
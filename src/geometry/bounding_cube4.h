@@ -0,0 +1,110 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include "bounding_cube.h"
+#include "ray.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+using glm::vec3;
+
+// A ray prepared for being tested against many boxes, i.e. the start and
+// inverse direction are split into their axes so they can be broadcast into
+// SIMD lanes once per ray rather than once per box.
+struct BoxTestRay {
+    float start[3];
+    // The inverse direction, so the distances returned by box tests are in
+    // multiples of the ray's direction.
+    float inv_dir[3];
+    // Whether the direction is negative along each axis, in which case the
+    // ray enters a box through its maximum face rather than its minimum.
+    bool is_negative[3];
+
+    BoxTestRay(const Ray &ray) {
+        for (int axis=0; axis<3; axis++) {
+            start[axis] = ray.start[axis];
+            // Rays parallel to an axis have an infinite inverse direction,
+            // which is replaced by a large finite value. Otherwise, as we
+            // compile with -ffast-math, the box tests are undefined, and a ray
+            // starting on the plane of a box face would produce a NaN.
+            float dir = ray.dir[axis];
+            float inv = std::abs(dir) > min_abs_dir ? 1.0f / dir : std::copysign(1.0f / min_abs_dir, dir);
+            inv_dir[axis] = inv;
+            is_negative[axis] = inv < 0.0f;
+        }
+    }
+
+private:
+    // Direction components smaller than this are treated as being zero.
+    static constexpr float min_abs_dir = 1e-20f;
+};
+
+// Four bounding cubes stored as a structure of arrays, so that a ray can be
+// tested against all four at once using SSE.
+struct BoundingCube4 {
+    // The minimum and maximum corners of each box, indexed by [axis][box].
+    float min[3][4];
+    float max[3][4];
+
+    // effect: sets the box in the given lane.
+    void set(int lane, vec3 box_min, vec3 box_max) {
+        for (int axis=0; axis<3; axis++) {
+            min[axis][lane] = box_min[axis];
+            max[axis][lane] = box_max[axis];
+        }
+    }
+
+    // param t_min: the start of the interval along the ray to test.
+    // param t_max: the end of the interval along the ray to test, e.g. the
+    //              closest intersection found so far.
+    // param t_enter: set to the distance at which the ray enters each box.
+    // return: a bitmask with bit i set if the ray intersects box i within the
+    //         interval.
+    int intersect_ray(const BoxTestRay &ray, float t_min, float t_max, float t_enter[4]) const {
+#if defined(__SSE__)
+        __m128 enter = _mm_set1_ps(t_min);
+        __m128 exit = _mm_set1_ps(t_max);
+
+        for (int axis=0; axis<3; axis++) {
+            __m128 start = _mm_set1_ps(ray.start[axis]);
+            __m128 inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+
+            // The faces the ray enters and exits through are known from the
+            // sign of its direction, so do not need to be found per box.
+            const float *near = ray.is_negative[axis] ? max[axis] : min[axis];
+            const float *far = ray.is_negative[axis] ? min[axis] : max[axis];
+
+            __m128 t_near = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near), start), inv_dir);
+            __m128 t_far = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far), start), inv_dir);
+
+            enter = _mm_max_ps(enter, t_near);
+            exit = _mm_min_ps(exit, t_far);
+        }
+
+        _mm_storeu_ps(t_enter, enter);
+        return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+#else
+        int mask = 0;
+        for (int lane=0; lane<4; lane++) {
+            float enter = t_min, exit = t_max;
+
+            for (int axis=0; axis<3; axis++) {
+                float near = ray.is_negative[axis] ? max[axis][lane] : min[axis][lane];
+                float far = ray.is_negative[axis] ? min[axis][lane] : max[axis][lane];
+
+                enter = std::max(enter, (near - ray.start[axis]) * ray.inv_dir[axis]);
+                exit = std::min(exit, (far - ray.start[axis]) * ray.inv_dir[axis]);
+            }
+
+            t_enter[lane] = enter;
+            mask |= (enter <= exit) << lane;
+        }
+        return mask;
+#endif
+    }
+} __attribute__((aligned(16)));
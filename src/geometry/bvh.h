@@ -0,0 +1,545 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include <stdint.h>
+#include "bounding_cube.h"
+#include "bounding_cube4.h"
+#include "ray.h"
+#include "ray_packet.h"
+#include "ray_stats.h"
+
+using glm::vec3;
+using std::vector;
+
+// A node in a binary bounding volume hierarchy, used while building the tree.
+// The first child of an interior node is stored directly after it, so only
+// the index of the second child needs to be stored.
+struct BVHNode {
+    // The corners of the box enclosing everything below this node.
+    vec3 min, max;
+    // For a leaf, the index of the first item in the leaf. For an interior
+    // node, the index of the second child.
+    int offset;
+    // The number of items in the leaf, or 0 if this is an interior node.
+    int count;
+
+    bool is_leaf() const {
+        return count > 0;
+    }
+};
+
+// A node with up to four children, made by collapsing levels of the binary
+// tree. The boxes of the children are stored together so the ray can be
+// tested against all of them at once.
+struct BVHWideNode {
+    // The boxes of the children.
+    BoundingCube4 bounds;
+    // For a leaf child, the index of its first item. For an interior child,
+    // the index of its node.
+    int child[4];
+    // The number of items in each leaf child, or 0 for interior children.
+    int count[4];
+    // The number of children which are in use.
+    int num_children;
+};
+
+// A bounding volume hierarchy built using the surface area heuristic (SAH).
+// The hierarchy is built over a list of bounding cubes and stores the indices
+// of those cubes, therefore it can be used to accelerate queries over
+// anything which has a bounding cube, e.g. primitives or objects.
+class BVH {
+public:
+    // The nodes of the tree in depth-first order. The root is at index 0.
+    vector<BVHWideNode> nodes;
+    // The indices of the items, ordered so the items in each leaf are
+    // contiguous.
+    vector<int> item_indices;
+
+    // param item_bounds: the bounding cube of each item to build the tree over.
+    BVH(const vector<BoundingCube> &item_bounds) {
+        if (item_bounds.empty()) {
+            return;
+        }
+
+        const int num_items = item_bounds.size();
+        vector<vec3> mins(num_items), maxs(num_items), centroids(num_items);
+
+        for (int i=0; i<num_items; i++) {
+            mins[i] = vec3(item_bounds[i].min);
+            maxs[i] = vec3(item_bounds[i].max);
+            centroids[i] = (mins[i] + maxs[i]) * 0.5f;
+            item_indices.push_back(i);
+        }
+
+        // A binary tree has at most 2n-1 nodes.
+        vector<BVHNode> binary_nodes;
+        binary_nodes.reserve(2 * num_items - 1);
+        this->build(binary_nodes, 0, num_items, 0, mins, maxs, centroids);
+
+        // The root is placed in a wide node on its own, in case it is a leaf.
+        nodes.push_back(BVHWideNode());
+        for (int c=0; c<4; c++) {
+            nodes[0].bounds.set(c, binary_nodes[0].min, binary_nodes[0].max);
+        }
+        nodes[0].num_children = 1;
+        this->set_child(binary_nodes, 0, 0, 0);
+    }
+
+    // param nodes, item_indices: a hierarchy which was built previously, e.g.
+    //                           loaded from a file.
+    BVH(vector<BVHWideNode> nodes, vector<int> item_indices):
+        nodes(std::move(nodes)), item_indices(std::move(item_indices))
+    {
+    }
+
+    // param num_items: the number of items the hierarchy was built over.
+    // return: whether every child and item index is in range, and the tree
+    //         is no deeper than the traversal stack allows. Used to check a
+    //         hierarchy loaded from a file, which may have been corrupted.
+    bool is_valid(int num_items) const {
+        for (int item: this->item_indices) {
+            if (item < 0 || item >= num_items) {
+                return false;
+            }
+        }
+
+        // Nodes are in depth-first order, so each interior child comes
+        // after its parent, and the depth of a node is known before its
+        // children are reached. This also rules out cycles.
+        vector<int> depths(this->nodes.size(), 0);
+        for (size_t n=0; n<this->nodes.size(); n++) {
+            const BVHWideNode &node = this->nodes[n];
+            if (node.num_children < 1 || node.num_children > 4 || depths[n] > max_depth + 1) {
+                return false;
+            }
+
+            for (int c=0; c<node.num_children; c++) {
+                const int child = node.child[c];
+                const int count = node.count[c];
+
+                if (count > 0) {
+                    if (child < 0 || child > (int)this->item_indices.size() - count) {
+                        return false;
+                    }
+                } else if (count < 0 || child <= (int)n || child >= (int)this->nodes.size()) {
+                    return false;
+                } else {
+                    depths[child] = std::max(depths[child], depths[n] + 1);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // param max_dist: the distance along the ray, in multiples of its
+    //                 direction, beyond which nodes are skipped. This is
+    //                 re-read after each item is visited, therefore
+    //                 visit_item can shrink it as closer intersections are
+    //                 found, or make it negative to end the traversal.
+    // param visit_item: called with the index of each item in a leaf the
+    //                   ray passes through.
+    // effect: visits the items whose leaves are intersected by the ray,
+    //         visiting nearer nodes first.
+    template<typename F>
+    void traverse(const Ray &ray, const float &max_dist, F visit_item) const {
+        auto visit_leaf = [&](int first, int count) {
+            for (int i=first; i<first + count; i++) {
+                visit_item(item_indices[i]);
+            }
+        };
+
+        this->traverse_leaves(ray, max_dist, visit_leaf);
+    }
+
+    // param max_dist: as for traverse.
+    // param visit_leaf: called with the range [first, first + count) of
+    //                   item_indices making up each leaf the ray passes
+    //                   through. This allows the items to be stored in leaf
+    //                   order and processed a leaf at a time.
+    // effect: visits the leaves intersected by the ray, nearest first.
+    template<typename F>
+    void traverse_leaves(const Ray &ray, const float &max_dist, F visit_leaf) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        const BoxTestRay box_ray = BoxTestRay(ray);
+
+        // Nodes further than this are skipped. Slightly larger than max_dist
+        // so that rounding errors in the slab test do not cull items lying on
+        // the face of a box, e.g. triangles which are flat in one axis.
+        auto prune_dist = [&]() {
+            return max_dist * BVH::prune_slack;
+        };
+
+        // Children still to be visited, and the distance at which the ray
+        // enters each of them. Children are stored as in BVHWideNode, i.e. as
+        // the index of a node, or the first item and number of items in a
+        // leaf.
+        int stack[stack_capacity];
+        int stack_count[stack_capacity];
+        float stack_dist[stack_capacity];
+        int stack_size = 0;
+
+        // The root has no parent to test its box against, so start by
+        // testing the children of the root node.
+        stack[stack_size] = 0;
+        stack_count[stack_size] = 0;
+        stack_dist[stack_size++] = 0.0f;
+
+        while (stack_size > 0) {
+            stack_size--;
+            // A closer intersection may have been found since this node was
+            // pushed onto the stack.
+            if (stack_dist[stack_size] > prune_dist()) {
+                continue;
+            }
+
+            if (stack_count[stack_size] > 0) {
+                visit_leaf(stack[stack_size], stack_count[stack_size]);
+                continue;
+            }
+
+            const BVHWideNode &node = nodes[stack[stack_size]];
+
+            float t_enter[4];
+            int hit_mask = node.bounds.intersect_ray(box_ray, 0.0f, prune_dist(), t_enter);
+            hit_mask &= (1 << node.num_children) - 1;
+            COUNT_RAY_STAT(stat_box_tests, node.num_children);
+
+            // Push the children furthest first, so the nearest child is visited
+            // first. This makes it more likely that closer intersections are
+            // found early and further children can be skipped.
+            const int first_pushed = stack_size;
+            for (int c=0; c<4; c++) {
+                if (!(hit_mask & (1 << c))) {
+                    continue;
+                }
+
+                // Insertion sort by descending distance.
+                int pos = stack_size++;
+                while (pos > first_pushed && stack_dist[pos - 1] < t_enter[c]) {
+                    stack[pos] = stack[pos - 1];
+                    stack_count[pos] = stack_count[pos - 1];
+                    stack_dist[pos] = stack_dist[pos - 1];
+                    pos--;
+                }
+                stack[pos] = node.child[c];
+                stack_count[pos] = node.count[c];
+                stack_dist[pos] = t_enter[c];
+            }
+        }
+    }
+
+    // param max_dists: the distance beyond which nodes are skipped for each
+    //                  ray in the packet, as for max_dist in traverse.
+    // param ray_mask: the rays in the packet to traverse with.
+    // param visit_leaf: called with the range of item_indices making up each
+    //                   leaf, as in traverse_leaves, along with a mask of
+    //                   the rays which intersect the leaf.
+    // effect: visits the leaves intersected by any ray in the packet, nearest
+    //         first. Nodes are culled for the whole packet using its
+    //         frustum, and the rays are only tested individually against
+    //         the boxes of leaves.
+    template<typename F>
+    void traverse_packet(const RayPacket &packet, const float *max_dists, uint64_t ray_mask, F visit_leaf) const {
+        if (nodes.empty() || ray_mask == 0) {
+            return;
+        }
+
+        // Nodes further than this are skipped for the whole packet.
+        auto prune_dist = [&]() {
+            float dist = -std::numeric_limits<float>::max();
+            for (int r=0; r<packet_size; r++) {
+                if (ray_mask & ((uint64_t)1 << r)) {
+                    dist = std::max(dist, max_dists[r]);
+                }
+            }
+            return dist * BVH::prune_slack;
+        };
+
+        // As in traverse_leaves, along with the mask of rays which may
+        // intersect each child.
+        int stack[stack_capacity];
+        int stack_count[stack_capacity];
+        float stack_dist[stack_capacity];
+        uint64_t stack_rays[stack_capacity];
+        int stack_size = 0;
+
+        stack[stack_size] = 0;
+        stack_count[stack_size] = 0;
+        stack_rays[stack_size] = ray_mask;
+        stack_dist[stack_size++] = 0.0f;
+
+        float packet_prune_dist = prune_dist();
+
+        while (stack_size > 0) {
+            stack_size--;
+            if (stack_dist[stack_size] > packet_prune_dist) {
+                continue;
+            }
+
+            if (stack_count[stack_size] > 0) {
+                visit_leaf(stack[stack_size], stack_count[stack_size], stack_rays[stack_size]);
+                packet_prune_dist = prune_dist();
+                continue;
+            }
+
+            const BVHWideNode &node = nodes[stack[stack_size]];
+            const uint64_t node_rays = stack_rays[stack_size];
+
+            float t_enter[4];
+            int hit_mask = packet.intersect_boxes(node.bounds, packet_prune_dist, t_enter);
+            hit_mask &= (1 << node.num_children) - 1;
+            COUNT_RAY_STAT(stat_box_tests, node.num_children);
+
+            const int first_pushed = stack_size;
+            for (int c=0; c<4; c++) {
+                if (!(hit_mask & (1 << c))) {
+                    continue;
+                }
+
+                // Testing every ray is only worth it for leaves, where it
+                // saves intersecting the items with rays that miss them.
+                uint64_t child_rays = node_rays;
+                if (node.count[c] > 0) {
+                    child_rays = packet.intersect_box_rays(node.bounds, c, max_dists, BVH::prune_slack, node_rays);
+                    COUNT_RAY_STAT(stat_box_tests, __builtin_popcountll(node_rays));
+                    if (child_rays == 0) {
+                        continue;
+                    }
+                }
+
+                // Insertion sort by descending distance, as in
+                // traverse_leaves.
+                int pos = stack_size++;
+                while (pos > first_pushed && stack_dist[pos - 1] < t_enter[c]) {
+                    stack[pos] = stack[pos - 1];
+                    stack_count[pos] = stack_count[pos - 1];
+                    stack_dist[pos] = stack_dist[pos - 1];
+                    stack_rays[pos] = stack_rays[pos - 1];
+                    pos--;
+                }
+                stack[pos] = node.child[c];
+                stack_count[pos] = node.count[c];
+                stack_dist[pos] = t_enter[c];
+                stack_rays[pos] = child_rays;
+            }
+        }
+    }
+
+protected:
+    // The number of buckets the centroids are placed into when evaluating
+    // the SAH along an axis.
+    static const int num_bins = 12;
+    // Leaves are always split if they contain more items than this.
+    static const int max_leaf_size = 8;
+    // The cost of traversing a node, relative to intersecting an item.
+    static constexpr float traversal_cost = 1.0f;
+    // Multiplier on the distance beyond which nodes are skipped.
+    static constexpr float prune_slack = 1.0001f;
+    // The maximum depth of the tree, which bounds the size of the stack
+    // needed to traverse it.
+    static const int max_depth = 62;
+    // Each wide node covers at least one level of the binary tree, and
+    // visiting it replaces it on the stack with at most four children. This
+    // bounds the size of the traversal stack.
+    static const int stack_capacity = 3 * (max_depth + 2) + 1;
+
+    // return: the surface area of the box with the given corners.
+    static float surface_area(vec3 min, vec3 max) {
+        vec3 d = glm::max(max - min, vec3(0.0f));
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // effect: makes the binary node the child of the wide node at the given
+    //         slot. If the binary node is interior, it and its descendants
+    //         are collapsed into a new wide node by repeatedly opening the
+    //         interior child with the largest surface area.
+    void set_child(const vector<BVHNode> &binary_nodes, int wide_idx, int slot, int binary_idx) {
+        const BVHNode &binary = binary_nodes[binary_idx];
+
+        if (binary.is_leaf()) {
+            nodes[wide_idx].child[slot] = binary.offset;
+            nodes[wide_idx].count[slot] = binary.count;
+            return;
+        }
+
+        // The binary nodes which become the children of the new wide node.
+        int children[4] = { binary_idx + 1, binary.offset, -1, -1 };
+        int num_children = 2;
+
+        while (num_children < 4) {
+            int largest = -1;
+            float largest_area = -1.0f;
+
+            for (int c=0; c<num_children; c++) {
+                const BVHNode &child = binary_nodes[children[c]];
+                float area = surface_area(child.min, child.max);
+                if (!child.is_leaf() && area > largest_area) {
+                    largest = c;
+                    largest_area = area;
+                }
+            }
+
+            if (largest == -1) {
+                break;
+            }
+
+            const int opened = children[largest];
+            children[largest] = opened + 1;
+            children[num_children++] = binary_nodes[opened].offset;
+        }
+
+        const int new_idx = nodes.size();
+        nodes.push_back(BVHWideNode());
+        nodes[wide_idx].child[slot] = new_idx;
+        nodes[wide_idx].count[slot] = 0;
+
+        nodes[new_idx].num_children = num_children;
+        for (int c=0; c<4; c++) {
+            // Unused lanes are given the box of the first child so they do
+            // not produce NaNs. They are masked out during traversal.
+            const BVHNode &child = binary_nodes[children[c < num_children ? c : 0]];
+            nodes[new_idx].bounds.set(c, child.min, child.max);
+        }
+
+        for (int c=0; c<num_children; c++) {
+            this->set_child(binary_nodes, new_idx, c, children[c]);
+        }
+    }
+
+    // return: the index of the node built over the items in the range
+    //         [begin, end) of item_indices.
+    int build(vector<BVHNode> &binary_nodes, int begin, int end, int depth, const vector<vec3> &mins, const vector<vec3> &maxs, const vector<vec3> &centroids) {
+        const int node_idx = binary_nodes.size();
+        binary_nodes.push_back(BVHNode());
+
+        // Bounds of the items, and of their centroids which are used to
+        // decide where to split.
+        vec3 min = mins[item_indices[begin]], max = maxs[item_indices[begin]];
+        vec3 c_min = centroids[item_indices[begin]], c_max = c_min;
+        for (int i=begin+1; i<end; i++) {
+            int item = item_indices[i];
+            min = glm::min(min, mins[item]);
+            max = glm::max(max, maxs[item]);
+            c_min = glm::min(c_min, centroids[item]);
+            c_max = glm::max(c_max, centroids[item]);
+        }
+
+        binary_nodes[node_idx].min = min;
+        binary_nodes[node_idx].max = max;
+
+        const int count = end - begin;
+        int best_axis = -1, best_bin = -1;
+        float best_cost = std::numeric_limits<float>::max();
+
+        if (count > 1) {
+            BVH::find_split(begin, end, mins, maxs, centroids, c_min, c_max, best_axis, best_bin, best_cost);
+        }
+
+        // Cost of the split relative to intersecting every item in a leaf.
+        const float leaf_cost = count;
+        const float split_cost = traversal_cost + best_cost / surface_area(min, max);
+
+        // Make a leaf if the centroids all coincide, so cannot be split, if
+        // splitting is not worth it, or if the tree is too deep to traverse.
+        const bool can_split = best_axis != -1 && depth < max_depth;
+        if (!can_split || (split_cost >= leaf_cost && count <= max_leaf_size)) {
+            binary_nodes[node_idx].offset = begin;
+            binary_nodes[node_idx].count = count;
+            return node_idx;
+        }
+
+        const float scale = num_bins / (c_max[best_axis] - c_min[best_axis]);
+        auto in_left = [&](int item) {
+            return BVH::bin_index(centroids[item][best_axis], c_min[best_axis], scale) <= best_bin;
+        };
+        int mid = std::partition(item_indices.begin() + begin, item_indices.begin() + end, in_left) - item_indices.begin();
+
+        // Guard against floating point error putting every item on one side.
+        if (mid == begin || mid == end) {
+            mid = begin + count / 2;
+        }
+
+        this->build(binary_nodes, begin, mid, depth + 1, mins, maxs, centroids);
+        int second_child = this->build(binary_nodes, mid, end, depth + 1, mins, maxs, centroids);
+
+        binary_nodes[node_idx].offset = second_child;
+        binary_nodes[node_idx].count = 0;
+        return node_idx;
+    }
+
+    // return: the bin the centroid falls into.
+    static int bin_index(float centroid, float min, float scale) {
+        int bin = (int)((centroid - min) * scale);
+        return std::min(std::max(bin, 0), num_bins - 1);
+    }
+
+    // effect: finds the split, along any axis, with the lowest SAH cost by
+    //         placing the centroids into bins. The cost is not normalised
+    //         by the surface area of the parent.
+    void find_split(int begin, int end, const vector<vec3> &mins, const vector<vec3> &maxs, const vector<vec3> &centroids, vec3 c_min, vec3 c_max, int &best_axis, int &best_bin, float &best_cost) const {
+        for (int axis=0; axis<3; axis++) {
+            if (c_max[axis] <= c_min[axis]) {
+                continue;
+            }
+
+            const float scale = num_bins / (c_max[axis] - c_min[axis]);
+
+            int bin_counts[num_bins] = { 0 };
+            vec3 bin_mins[num_bins], bin_maxs[num_bins];
+            for (int b=0; b<num_bins; b++) {
+                bin_mins[b] = vec3(std::numeric_limits<float>::max());
+                bin_maxs[b] = vec3(-std::numeric_limits<float>::max());
+            }
+
+            for (int i=begin; i<end; i++) {
+                int item = item_indices[i];
+                int b = BVH::bin_index(centroids[item][axis], c_min[axis], scale);
+                bin_counts[b]++;
+                bin_mins[b] = glm::min(bin_mins[b], mins[item]);
+                bin_maxs[b] = glm::max(bin_maxs[b], maxs[item]);
+            }
+
+            // Sweep from the right to find the cost of everything to the
+            // right of each split plane.
+            float right_costs[num_bins];
+            vec3 r_min = vec3(std::numeric_limits<float>::max());
+            vec3 r_max = vec3(-std::numeric_limits<float>::max());
+            int r_count = 0;
+            for (int b=num_bins-1; b>0; b--) {
+                r_min = glm::min(r_min, bin_mins[b]);
+                r_max = glm::max(r_max, bin_maxs[b]);
+                r_count += bin_counts[b];
+                right_costs[b - 1] = r_count * surface_area(r_min, r_max);
+            }
+
+            // Sweep from the left, combining with the right costs.
+            vec3 l_min = vec3(std::numeric_limits<float>::max());
+            vec3 l_max = vec3(-std::numeric_limits<float>::max());
+            int l_count = 0;
+            for (int b=0; b<num_bins-1; b++) {
+                l_min = glm::min(l_min, bin_mins[b]);
+                l_max = glm::max(l_max, bin_maxs[b]);
+                l_count += bin_counts[b];
+
+                if (l_count == 0 || l_count == end - begin) {
+                    continue;
+                }
+
+                float cost = l_count * surface_area(l_min, l_max) + right_costs[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
+#include <stdint.h>
+#include "object.h"
+#include "ray.h"
+#include "sphere8.h"
+#include "ray_packet.h"
+#include "ray_stats.h"
+#include "primitives/primitive.h"
+#include "primitives/triangle.h"
+#include "primitives/sphere.h"
+#include "primitives/disc.h"
+#include "primitives/mesh.h"
+
+using glm::vec2;
+using glm::vec3;
+using std::vector;
+using std::optional;
+
+// The types of primitive which are stored in their own arrays once compiled.
+// Primitives of any other type are intersected through Primitive.
+enum CompiledPrimitiveType {
+    compiled_triangle, compiled_sphere, compiled_disc, compiled_other
+};
+
+// An array of 3D vectors, stored as a separate array for each component.
+struct Vec3Array {
+    vector<float> x, y, z;
+
+    void push_back(vec3 v) {
+        x.push_back(v.x);
+        y.push_back(v.y);
+        z.push_back(v.z);
+    }
+
+    vec3 operator[](int i) const {
+        return vec3(x[i], y[i], z[i]);
+    }
+};
+
+// The properties of Triangle, with one entry per triangle.
+struct TriangleArrays {
+    Vec3Array v0, e1, e2, e1_cross_e2;
+    // The index of each triangle in the object's array of primitives.
+    vector<int> prim_indices;
+};
+
+// The properties of Sphere, with one entry per sphere. The arrays, apart from
+// prim_indices, are padded so a batch of spheres can be loaded starting from
+// any sphere.
+struct SphereArrays {
+    Vec3Array centers;
+    // The squared radius of each sphere.
+    vector<float> radii2;
+    vector<int> prim_indices;
+};
+
+// The properties of Disc, with one entry per disc.
+struct DiscArrays {
+    Vec3Array centers, normals;
+    vector<float> inner_radii, outer_radii;
+    vector<int> prim_indices;
+};
+
+// The primitives of an Object, compiled into a structure of arrays with
+// separate arrays for each type of primitive. Each leaf of the object's
+// hierarchy is then intersected with a loop per type of primitive, rather
+// than a virtual call per primitive through pointers spread across the heap.
+//
+// The primitives are copied in the order of the leaves of the hierarchy, and
+// grouped by type within each leaf, so the primitives of a leaf are
+// contiguous in each array. The faces of a mesh are already stored in shared
+// buffers, so are read from the mesh rather than copied.
+//
+// Objects and primitives are still used to build the scene and for shading.
+// The compiled copy does not change if the primitives are modified after it
+// is made. Instances of an object share its compiled copy, as they share its
+// primitives.
+class CompiledObject {
+public:
+    // The object which was compiled.
+    const Object *object;
+
+    CompiledObject(const Object *object): object(object) {
+        // The faces of a mesh are read directly from its buffers.
+        if (object->mesh != nullptr) {
+            return;
+        }
+
+        // The index of the primitive to store at each position, or slot, in
+        // the order of the leaves of the hierarchy.
+        vector<int> slot_prims = object->bvh->item_indices;
+        CompiledObject::group_leaves_by_type(object, slot_prims);
+
+        for (int prim_idx : slot_prims) {
+            this->add_primitive(prim_idx);
+        }
+
+        for (int i=0; i<sphere_batch_size-1; i++) {
+            this->spheres.centers.push_back(vec3(0.0f));
+            this->spheres.radii2.push_back(0.0f);
+        }
+    }
+
+    // param t_max: hits further along the ray than this, in multiples of its
+    //              direction, are ignored. This is re-read after each hit,
+    //              therefore visit_hit can shrink it as closer hits are found,
+    //              or make it negative to end the search.
+    // param visit_hit: called with the index, in the object's array of
+    //                  primitives, of each primitive hit, along with the hit.
+    // effect: intersects the ray with the primitives of the object, in no
+    //         particular order.
+    template<typename F>
+    void intersect(const Ray &ray, const float &t_max, F visit_hit) const {
+        const BVH &bvh = *this->object->bvh;
+
+        if (this->object->mesh != nullptr) {
+            const Mesh *mesh = this->object->mesh;
+
+            auto visit_leaf = [&](int first, int count) {
+                COUNT_RAY_STAT(stat_triangle_tests, count);
+                for (int s=first; s<first + count; s++) {
+                    const int face = bvh.item_indices[s];
+
+                    Hit hit;
+                    if (MeshTriangle::intersect_face(ray, mesh->vertices, &mesh->indices[3 * face], 0.0f, t_max, hit)) {
+                        visit_hit(face, hit);
+                    }
+                }
+            };
+
+            bvh.traverse_leaves(ray, t_max, visit_leaf);
+            return;
+        }
+
+        auto visit_leaf = [&](int first, int count) {
+            auto visit_group = [&](uint8_t type, int begin, int end) {
+                switch (type) {
+                    case compiled_triangle:
+                        this->intersect_triangles(ray, begin, end, t_max, visit_hit);
+                        break;
+                    case compiled_sphere:
+                        this->intersect_spheres(ray, begin, end, t_max, visit_hit);
+                        break;
+                    case compiled_disc:
+                        this->intersect_discs(ray, begin, end, t_max, visit_hit);
+                        break;
+                    default:
+                        this->intersect_others(ray, begin, end, t_max, visit_hit);
+                        break;
+                }
+            };
+
+            this->for_each_group(first, count, visit_group);
+        };
+
+        bvh.traverse_leaves(ray, t_max, visit_leaf);
+    }
+
+    // param packet: rays which start at the same position.
+    // param t_max: for each ray in the packet, as for intersect.
+    // param ray_mask: the rays in the packet to intersect.
+    // param visit_hit: called with the index of the ray in the packet, the
+    //                  index of the primitive, and the hit, for each
+    //                  primitive hit by each ray.
+    // effect: intersects the rays with the primitives of the object, as
+    //         intersect does for each ray. Triangles are tested against a
+    //         chunk of rays at once.
+    template<typename F>
+    void intersect_packet(const RayPacket &packet, const float *t_max, uint64_t ray_mask, F visit_hit) const {
+        const BVH &bvh = *this->object->bvh;
+
+        // effect: calls visit_ray with the index of each ray in the mask.
+        auto for_each_ray = [&](uint64_t rays, auto visit_ray) {
+            for (; rays != 0; rays &= rays - 1) {
+                visit_ray(__builtin_ctzll(rays));
+            }
+        };
+
+        if (this->object->mesh != nullptr) {
+            const Mesh *mesh = this->object->mesh;
+
+            auto visit_leaf = [&](int first, int count, uint64_t rays) {
+                for (int s=first; s<first + count; s++) {
+                    const int face = bvh.item_indices[s];
+                    const int *indices = &mesh->indices[3 * face];
+
+                    // As in MeshTriangle::intersect_face.
+                    const vec3 v0 = mesh->vertices[indices[0]];
+                    const vec3 e1 = mesh->vertices[indices[1]] - v0;
+                    const vec3 e2 = mesh->vertices[indices[2]] - v0;
+                    const vec3 e1_cross_e2 = cross(e1, e2);
+
+                    auto visit_tuv = [&](int r, vec3 tuv) {
+                        Hit hit;
+                        hit.t = tuv.x;
+                        visit_hit(r, face, hit);
+                    };
+
+                    CompiledObject::intersect_triangle_packet(packet, v0, e1, e2, e1_cross_e2, t_max, rays, visit_tuv);
+                }
+            };
+
+            bvh.traverse_packet(packet, t_max, ray_mask, visit_leaf);
+            return;
+        }
+
+        auto visit_leaf = [&](int first, int count, uint64_t rays) {
+            auto visit_group = [&](uint8_t type, int begin, int end) {
+                if (type == compiled_triangle) {
+                    const TriangleArrays &tris = this->triangles;
+
+                    for (int k=begin; k<end; k++) {
+                        auto visit_tuv = [&](int r, vec3 tuv) {
+                            Hit hit;
+                            hit.t = tuv.x;
+                            visit_hit(r, tris.prim_indices[k], hit);
+                        };
+
+                        CompiledObject::intersect_triangle_packet(packet, tris.v0[k], tris.e1[k], tris.e2[k], tris.e1_cross_e2[k], t_max, rays, visit_tuv);
+                    }
+                    return;
+                }
+
+                // Other types are intersected a ray at a time.
+                for_each_ray(rays, [&](int r) {
+                    auto visit_ray_hit = [&](int prim_idx, const Hit &hit) {
+                        visit_hit(r, prim_idx, hit);
+                    };
+
+                    const Ray &ray = packet.rays[r];
+                    switch (type) {
+                        case compiled_sphere:
+                            this->intersect_spheres(ray, begin, end, t_max[r], visit_ray_hit);
+                            break;
+                        case compiled_disc:
+                            this->intersect_discs(ray, begin, end, t_max[r], visit_ray_hit);
+                            break;
+                        default:
+                            this->intersect_others(ray, begin, end, t_max[r], visit_ray_hit);
+                            break;
+                    }
+                });
+            };
+
+            this->for_each_group(first, count, visit_group);
+        };
+
+        bvh.traverse_packet(packet, t_max, ray_mask, visit_leaf);
+    }
+
+private:
+    // The type of the primitive in each slot, i.e. position in the order of
+    // the leaves of the hierarchy.
+    vector<uint8_t> slot_types;
+    // The index of the primitive in each slot in the arrays for its type.
+    vector<int> slot_offsets;
+
+    TriangleArrays triangles;
+    SphereArrays spheres;
+    DiscArrays discs;
+    // The indices of primitives of any other type.
+    vector<int> other_prim_indices;
+
+    // return: the array the primitive is compiled into.
+    static CompiledPrimitiveType type_of(const Primitive *prim) {
+        // Subclasses may override intersect, so only exact types are copied.
+        const std::type_info &type = typeid(*prim);
+
+        if (type == typeid(Triangle)) {
+            return compiled_triangle;
+        } else if (type == typeid(Sphere)) {
+            return compiled_sphere;
+        } else if (type == typeid(Disc)) {
+            return compiled_disc;
+        }
+        return compiled_other;
+    }
+
+    // effect: sorts the slots within each leaf of the hierarchy by type, so
+    //         the primitives of each type in a leaf are contiguous.
+    static void group_leaves_by_type(const Object *object, vector<int> &slot_prims) {
+        vector<uint8_t> prim_types(object->num_prims);
+        for (int i=0; i<object->num_prims; i++) {
+            prim_types[i] = CompiledObject::type_of(object->primitives[i]);
+        }
+
+        // Leaves are small, so an insertion sort is used rather than
+        // std::stable_sort, which allocates a buffer each time it is called.
+        for (const BVHWideNode &node : object->bvh->nodes) {
+            for (int c=0; c<node.num_children; c++) {
+                const int first = node.child[c];
+                for (int i=first+1; i<first + node.count[c]; i++) {
+                    const int prim = slot_prims[i];
+                    int j = i;
+                    for (; j > first && prim_types[slot_prims[j-1]] > prim_types[prim]; j--) {
+                        slot_prims[j] = slot_prims[j-1];
+                    }
+                    slot_prims[j] = prim;
+                }
+            }
+        }
+    }
+
+    // effect: copies the primitive into the next slot, and the arrays for
+    //         its type.
+    void add_primitive(int prim_idx) {
+        const Primitive *prim = this->object->primitives[prim_idx];
+        const CompiledPrimitiveType type = CompiledObject::type_of(prim);
+        this->slot_types.push_back(type);
+
+        switch (type) {
+            case compiled_triangle: {
+                const Triangle *triangle = (const Triangle*)prim;
+                this->slot_offsets.push_back(this->triangles.prim_indices.size());
+                this->triangles.v0.push_back(vec3(triangle->v0));
+                this->triangles.e1.push_back(triangle->e1);
+                this->triangles.e2.push_back(triangle->e2);
+                this->triangles.e1_cross_e2.push_back(triangle->e1_cross_e2);
+                this->triangles.prim_indices.push_back(prim_idx);
+                break;
+            }
+            case compiled_sphere: {
+                const Sphere *sphere = (const Sphere*)prim;
+                this->slot_offsets.push_back(this->spheres.prim_indices.size());
+                this->spheres.centers.push_back(vec3(sphere->center));
+                this->spheres.radii2.push_back(sphere->radius * sphere->radius);
+                this->spheres.prim_indices.push_back(prim_idx);
+                break;
+            }
+            case compiled_disc: {
+                const Disc *disc = (const Disc*)prim;
+                this->slot_offsets.push_back(this->discs.prim_indices.size());
+                this->discs.centers.push_back(vec3(disc->center));
+                this->discs.normals.push_back(vec3(disc->normal_dir));
+                this->discs.inner_radii.push_back(disc->inner_r);
+                this->discs.outer_radii.push_back(disc->outer_r);
+                this->discs.prim_indices.push_back(prim_idx);
+                break;
+            }
+            default:
+                this->slot_offsets.push_back(this->other_prim_indices.size());
+                this->other_prim_indices.push_back(prim_idx);
+                break;
+        }
+    }
+
+    // param first, count: the slots in a leaf of the hierarchy.
+    // param visit_group: called with the type of each group of primitives
+    //                    in the leaf, and the range of the group in the
+    //                    arrays for its type.
+    template<typename F>
+    void for_each_group(int first, int count, F visit_group) const {
+        const int end = first + count;
+        int group_start = first;
+
+        while (group_start < end) {
+            const uint8_t type = this->slot_types[group_start];
+            int group_end = group_start + 1;
+            while (group_end < end && this->slot_types[group_end] == type) {
+                group_end++;
+            }
+
+            // The group is contiguous in the arrays for its type.
+            const int begin = this->slot_offsets[group_start];
+            visit_group(type, begin, begin + (group_end - group_start));
+
+            group_start = group_end;
+        }
+    }
+
+    // effect: intersects the rays in the mask with the triangle, a chunk of
+    //         rays at a time, calling visit_tuv with the index of each ray
+    //         which hits the triangle and the intersection as [t u v].
+    template<typename F>
+    static void intersect_triangle_packet(const RayPacket &packet, vec3 v0, vec3 e1, vec3 e2, vec3 e1_cross_e2, const float *t_max, uint64_t ray_mask, F &visit_tuv) {
+        COUNT_RAY_STAT(stat_triangle_tests, __builtin_popcountll(ray_mask));
+        for (int first=0; first<packet_size; first+=packet_chunk_size) {
+            const int chunk_rays = (ray_mask >> first) & 0xff;
+            if (chunk_rays == 0) {
+                continue;
+            }
+
+            vec3 tuv[packet_chunk_size];
+            int hit_mask = packet.intersect_triangle(first, v0, e1, e2, e1_cross_e2, t_max, tuv) & chunk_rays;
+
+            for (; hit_mask != 0; hit_mask &= hit_mask - 1) {
+                const int i = __builtin_ctz(hit_mask);
+                visit_tuv(first + i, tuv[i]);
+            }
+        }
+    }
+
+    // effect: intersects the ray with the triangles in [begin, end), calling
+    //         visit_hit with each hit.
+    template<typename F>
+    void intersect_triangles(const Ray &ray, int begin, int end, const float &t_max, F &visit_hit) const {
+        const TriangleArrays &tris = this->triangles;
+        COUNT_RAY_STAT(stat_triangle_tests, end - begin);
+
+        for (int k=begin; k<end; k++) {
+            optional<vec3> tuv = Triangle::solve_intersection(ray, tris.v0[k], tris.e1[k], tris.e2[k], tris.e1_cross_e2[k]);
+
+            if (!tuv.has_value() || tuv->x <= 0.0f || tuv->x > t_max) {
+                continue;
+            }
+
+            Hit hit;
+            hit.t = tuv->x;
+            visit_hit(tris.prim_indices[k], hit);
+        }
+    }
+
+    // effect: intersects the ray with the spheres in [begin, end), calling
+    //         visit_hit with each hit. The spheres are tested in batches,
+    //         which is at most one batch per leaf of the hierarchy.
+    template<typename F>
+    void intersect_spheres(const Ray &ray, int begin, int end, const float &t_max, F &visit_hit) const {
+        const SphereArrays &spheres = this->spheres;
+        const SphereTestRay sphere_ray = SphereTestRay(ray);
+        COUNT_RAY_STAT(stat_sphere_tests, end - begin);
+
+        for (int k=begin; k<end; k+=sphere_batch_size) {
+            const int count = std::min(end - k, sphere_batch_size);
+
+            float t_hit[sphere_batch_size];
+            int hit_mask = intersect_spheres8(sphere_ray, &spheres.centers.x[k], &spheres.centers.y[k], &spheres.centers.z[k], &spheres.radii2[k], count, t_max * sphere_ray.dir_length, t_hit);
+
+            for (; hit_mask != 0; hit_mask &= hit_mask - 1) {
+                const int lane = __builtin_ctz(hit_mask);
+
+                // The hit may be beyond a closer hit found in an earlier lane.
+                if (t_hit[lane] > t_max * sphere_ray.dir_length) {
+                    continue;
+                }
+
+                Hit hit;
+                hit.t = t_hit[lane] / sphere_ray.dir_length;
+                visit_hit(spheres.prim_indices[k + lane], hit);
+            }
+        }
+    }
+
+    // effect: intersects the ray with the discs in [begin, end), calling
+    //         visit_hit with each hit.
+    template<typename F>
+    void intersect_discs(const Ray &ray, int begin, int end, const float &t_max, F &visit_hit) const {
+        const DiscArrays &discs = this->discs;
+        COUNT_RAY_STAT(stat_disc_tests, end - begin);
+
+        for (int k=begin; k<end; k++) {
+            Hit hit;
+            if (Disc::solve_intersection(ray, discs.centers[k], discs.normals[k], discs.inner_radii[k], discs.outer_radii[k], 0.0f, t_max, hit)) {
+                visit_hit(discs.prim_indices[k], hit);
+            }
+        }
+    }
+
+    // effect: intersects the ray with the primitives of other types in
+    //         [begin, end), calling visit_hit with each hit.
+    template<typename F>
+    void intersect_others(const Ray &ray, int begin, int end, const float &t_max, F &visit_hit) const {
+        COUNT_RAY_STAT(stat_other_tests, end - begin);
+        for (int k=begin; k<end; k++) {
+            const int prim_idx = this->other_prim_indices[k];
+
+            Hit hit;
+            if (this->object->primitives[prim_idx]->intersect(ray, 0.0f, t_max, hit)) {
+                visit_hit(prim_idx, hit);
+            }
+        }
+    }
+};
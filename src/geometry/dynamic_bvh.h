@@ -0,0 +1,354 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+#include "bvh.h"
+#include "bounding_cube.h"
+#include "projection.h"
+
+using glm::vec3;
+using std::vector;
+
+// A BVH which can be updated as items are added, removed, or moved, e.g. the
+// top level of a scene whose objects are animated. Each update only touches
+// the part of the tree containing the item:
+//  - moving an item refits the boxes on the path from its leaf to the root,
+//  - adding an item rebuilds the leaf whose box grows least to include it,
+//  - removing an item shrinks its leaf, removing it if it becomes empty.
+// The entries of nodes and item_indices left unused by updates are
+// reclaimed by rebuilding the whole tree once there are more of them than
+// items, which also restores the quality of the tree.
+class DynamicBVH: public BVH {
+public:
+    // param item_bounds: the bounding cube of each item to build the tree over.
+    DynamicBVH(const vector<BoundingCube> &item_bounds): BVH(item_bounds) {
+        for (const BoundingCube &bounds: item_bounds) {
+            this->item_mins.push_back(vec3(bounds.min));
+            this->item_maxs.push_back(vec3(bounds.max));
+        }
+        this->link();
+    }
+
+    // return: the number of items in the tree.
+    int num_items() const {
+        return this->item_mins.size();
+    }
+
+    // effect: sets the bounds of the item, and refits the boxes above it.
+    void move_item(int item, const BoundingCube &bounds) {
+        this->item_mins[item] = vec3(bounds.min);
+        this->item_maxs[item] = vec3(bounds.max);
+
+        const int slot = this->item_slots[item];
+        this->refit(slot / 4, slot % 4);
+    }
+
+    // effect: adds an item, whose index is the number of items before it was
+    //         added.
+    void add_item(const BoundingCube &bounds) {
+        const int item = this->num_items();
+        this->item_mins.push_back(vec3(bounds.min));
+        this->item_maxs.push_back(vec3(bounds.max));
+        this->item_slots.push_back(-1);
+
+        if (this->nodes.empty()) {
+            this->rebuild();
+            return;
+        }
+
+        // Descend to the child whose box grows least to include the item,
+        // until reaching a leaf.
+        int node = 0, slot = 0, depth = 0;
+        while (true) {
+            const BVHWideNode &wide = this->nodes[node];
+            float best_growth = std::numeric_limits<float>::max();
+
+            for (int c=0; c<wide.num_children; c++) {
+                const vec3 min = DynamicBVH::lane_min(wide.bounds, c);
+                const vec3 max = DynamicBVH::lane_max(wide.bounds, c);
+                const float growth = surface_area(glm::min(min, this->item_mins[item]), glm::max(max, this->item_maxs[item]))
+                                   - surface_area(min, max);
+
+                if (growth < best_growth) {
+                    best_growth = growth;
+                    slot = c;
+                }
+            }
+
+            if (wide.count[slot] > 0) {
+                break;
+            }
+
+            node = wide.child[slot];
+            depth++;
+        }
+
+        // Each rebuilt leaf may deepen the tree, so rebuild everything before
+        // it gets too deep to traverse.
+        if (depth >= max_depth / 2) {
+            this->rebuild();
+            return;
+        }
+
+        const BVHWideNode &leaf_parent = this->nodes[node];
+        vector<int> items(this->item_indices.begin() + leaf_parent.child[slot],
+                          this->item_indices.begin() + leaf_parent.child[slot] + leaf_parent.count[slot]);
+        items.push_back(item);
+        this->unused_items += leaf_parent.count[slot];
+
+        this->replace_child(node, slot, items);
+        this->refit(node, slot);
+        this->rebuild_if_fragmented();
+    }
+
+    // effect: removes the item. If it was not the last item, the last item
+    //         takes its index, so the items stay numbered from zero.
+    void remove_item(int item) {
+        const int slot = this->item_slots[item];
+        BVHWideNode &leaf_parent = this->nodes[slot / 4];
+        const int first = leaf_parent.child[slot % 4];
+        const int last_in_leaf = first + leaf_parent.count[slot % 4] - 1;
+
+        // Move the item to the end of the leaf, then shrink the leaf.
+        for (int i=first; i<=last_in_leaf; i++) {
+            if (this->item_indices[i] == item) {
+                std::swap(this->item_indices[i], this->item_indices[last_in_leaf]);
+                break;
+            }
+        }
+        leaf_parent.count[slot % 4]--;
+        this->unused_items++;
+
+        if (leaf_parent.count[slot % 4] > 0) {
+            this->refit(slot / 4, slot % 4);
+        } else {
+            this->remove_child(slot / 4, slot % 4);
+        }
+
+        const int last = this->num_items() - 1;
+        if (item != last) {
+            const int last_slot = this->item_slots[last];
+            const BVHWideNode &last_parent = this->nodes[last_slot / 4];
+            const int last_first = last_parent.child[last_slot % 4];
+
+            for (int i=last_first; i<last_first + last_parent.count[last_slot % 4]; i++) {
+                if (this->item_indices[i] == last) {
+                    this->item_indices[i] = item;
+                    break;
+                }
+            }
+
+            this->item_slots[item] = last_slot;
+            this->item_mins[item] = this->item_mins[last];
+            this->item_maxs[item] = this->item_maxs[last];
+        }
+
+        this->item_slots.pop_back();
+        this->item_mins.pop_back();
+        this->item_maxs.pop_back();
+
+        this->rebuild_if_fragmented();
+    }
+
+private:
+    // The bounds of each item, kept to refit leaves and rebuild the tree.
+    vector<vec3> item_mins, item_maxs;
+    // The node and child slot, as node * 4 + slot, which holds each node,
+    // or -1 for the root. Used to walk from a node to the root.
+    vector<int> node_slots;
+    // The node and child slot, as above, of the leaf holding each item.
+    vector<int> item_slots;
+    // The number of entries in nodes and item_indices which are no longer
+    // part of the tree.
+    int unused_nodes = 0;
+    int unused_items = 0;
+
+    // return: the corners of the box in a lane.
+    static vec3 lane_min(const BoundingCube4 &bounds, int lane) {
+        return vec3(bounds.min[0][lane], bounds.min[1][lane], bounds.min[2][lane]);
+    }
+
+    static vec3 lane_max(const BoundingCube4 &bounds, int lane) {
+        return vec3(bounds.max[0][lane], bounds.max[1][lane], bounds.max[2][lane]);
+    }
+
+    // effect: rebuilds the whole tree from the bounds of the items.
+    void rebuild() {
+        vector<BoundingCube> bounds;
+        for (int i=0; i<this->num_items(); i++) {
+            bounds.push_back(BoundingCube(project_to_4D(this->item_mins[i]), project_to_4D(this->item_maxs[i])));
+        }
+
+        BVH rebuilt = BVH(bounds);
+        this->nodes = std::move(rebuilt.nodes);
+        this->item_indices = std::move(rebuilt.item_indices);
+        this->unused_nodes = 0;
+        this->unused_items = 0;
+        this->link();
+    }
+
+    // effect: rebuilds the tree if more entries of nodes and item_indices
+    //         are unused than there are items. The cost of rebuilding is
+    //         then spread over the updates which made the entries unused.
+    void rebuild_if_fragmented() {
+        if (this->unused_items + this->unused_nodes > this->num_items()) {
+            this->rebuild();
+        }
+    }
+
+    // effect: fills in node_slots and item_slots for the whole tree.
+    void link() {
+        this->node_slots.assign(this->nodes.size(), -1);
+        this->item_slots.assign(this->num_items(), -1);
+
+        for (int n=0; n<(int)this->nodes.size(); n++) {
+            for (int c=0; c<this->nodes[n].num_children; c++) {
+                this->link_child(n, c);
+            }
+        }
+    }
+
+    // effect: records that the child in the slot of the node is held there.
+    void link_child(int node, int slot) {
+        const BVHWideNode &wide = this->nodes[node];
+
+        if (wide.count[slot] == 0) {
+            this->node_slots[wide.child[slot]] = node * 4 + slot;
+            return;
+        }
+
+        for (int i=wide.child[slot]; i<wide.child[slot] + wide.count[slot]; i++) {
+            this->item_slots[this->item_indices[i]] = node * 4 + slot;
+        }
+    }
+
+    // effect: replaces the child in the slot of the node with a new subtree
+    //         built over the items. The nodes and items of the subtree are
+    //         added to the end of nodes and item_indices.
+    void replace_child(int node, int slot, const vector<int> &items) {
+        vector<BoundingCube> bounds;
+        for (int item: items) {
+            bounds.push_back(BoundingCube(project_to_4D(this->item_mins[item]), project_to_4D(this->item_maxs[item])));
+        }
+        const BVH subtree = BVH(bounds);
+
+        // The root of the subtree is not needed, as its only child takes
+        // its place in the slot. The other nodes are offset to where they
+        // are added.
+        const int node_offset = (int)this->nodes.size() - 1;
+        const int item_offset = this->item_indices.size();
+
+        for (size_t n=1; n<subtree.nodes.size(); n++) {
+            BVHWideNode wide = subtree.nodes[n];
+            for (int c=0; c<wide.num_children; c++) {
+                wide.child[c] += wide.count[c] > 0 ? item_offset : node_offset;
+            }
+            this->nodes.push_back(wide);
+        }
+
+        for (int i: subtree.item_indices) {
+            this->item_indices.push_back(items[i]);
+        }
+
+        const BVHWideNode &root = subtree.nodes[0];
+        this->nodes[node].child[slot] = root.child[0] + (root.count[0] > 0 ? item_offset : node_offset);
+        this->nodes[node].count[slot] = root.count[0];
+
+        this->node_slots.resize(this->nodes.size(), -1);
+        this->link_child(node, slot);
+        for (int n=node_offset+1; n<(int)this->nodes.size(); n++) {
+            for (int c=0; c<this->nodes[n].num_children; c++) {
+                this->link_child(n, c);
+            }
+        }
+    }
+
+    // effect: removes the child in the slot of the node, which is empty.
+    //         Nodes left with no children are removed from their parents.
+    void remove_child(int node, int slot) {
+        while (true) {
+            BVHWideNode &wide = this->nodes[node];
+
+            // Move the later children down to fill the slot.
+            for (int c=slot; c<wide.num_children-1; c++) {
+                wide.child[c] = wide.child[c + 1];
+                wide.count[c] = wide.count[c + 1];
+                wide.bounds.set(c, DynamicBVH::lane_min(wide.bounds, c + 1), DynamicBVH::lane_max(wide.bounds, c + 1));
+                this->link_child(node, c);
+            }
+            wide.num_children--;
+
+            if (wide.num_children > 0) {
+                // Unused lanes are given the box of the first child, as in
+                // BVH.
+                for (int c=wide.num_children; c<4; c++) {
+                    wide.bounds.set(c, DynamicBVH::lane_min(wide.bounds, 0), DynamicBVH::lane_max(wide.bounds, 0));
+                }
+
+                const int parent_slot = this->node_slots[node];
+                if (parent_slot != -1) {
+                    this->refit(parent_slot / 4, parent_slot % 4);
+                }
+                return;
+            }
+
+            const int parent_slot = this->node_slots[node];
+            if (parent_slot == -1) {
+                // Every item has been removed.
+                this->nodes.clear();
+                this->item_indices.clear();
+                this->node_slots.clear();
+                this->unused_nodes = 0;
+                this->unused_items = 0;
+                return;
+            }
+
+            this->unused_nodes++;
+            node = parent_slot / 4;
+            slot = parent_slot % 4;
+        }
+    }
+
+    // effect: recomputes the box of the child in the slot of the node, then
+    //         of each node above it, stopping once a box does not change.
+    void refit(int node, int slot) {
+        while (true) {
+            const BVHWideNode &wide = this->nodes[node];
+            vec3 min = vec3(std::numeric_limits<float>::max());
+            vec3 max = vec3(-std::numeric_limits<float>::max());
+
+            if (wide.count[slot] > 0) {
+                for (int i=wide.child[slot]; i<wide.child[slot] + wide.count[slot]; i++) {
+                    min = glm::min(min, this->item_mins[this->item_indices[i]]);
+                    max = glm::max(max, this->item_maxs[this->item_indices[i]]);
+                }
+            } else {
+                const BVHWideNode &child = this->nodes[wide.child[slot]];
+                for (int c=0; c<child.num_children; c++) {
+                    min = glm::min(min, DynamicBVH::lane_min(child.bounds, c));
+                    max = glm::max(max, DynamicBVH::lane_max(child.bounds, c));
+                }
+            }
+
+            if (min == DynamicBVH::lane_min(wide.bounds, slot) && max == DynamicBVH::lane_max(wide.bounds, slot)) {
+                return;
+            }
+
+            BoundingCube4 &bounds = this->nodes[node].bounds;
+            bounds.set(slot, min, max);
+            if (slot == 0) {
+                for (int c=wide.num_children; c<4; c++) {
+                    bounds.set(c, min, max);
+                }
+            }
+
+            const int parent_slot = this->node_slots[node];
+            if (parent_slot == -1) {
+                return;
+            }
+            node = parent_slot / 4;
+            slot = parent_slot % 4;
+        }
+    }
+};
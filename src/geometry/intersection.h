@@ -2,11 +2,10 @@
 
 #include <glm/glm.hpp>
 #include "ray.h"
+#include "projection.h"
+#include "primitives/primitive.h"
 
-using glm::mat3;
-using glm::inverse;
-
-class Primitive;
+using glm::vec4;
 
 class Intersection {
 public:
@@ -14,7 +13,18 @@ public:
     const vec4 pos;
     // The triangle that was intersected with.
     const Primitive *primitive;
+    // The object the primitive was hit as part of. This is needed to shade
+    // the primitive, as it may be shared by several instances of an object.
+    const Object *object;
+    // The distance to the intersection, in multiples of the ray's direction.
+    const float t;
 
-    Intersection(vec4 pos, const Primitive *primitive): pos(pos), primitive(primitive) {
+    // param ray: the ray which hit the primitive.
+    Intersection(const Ray &ray, const Hit &hit, const Primitive *primitive, const Object *object):
+        pos(project_to_4D(ray.at(hit.t))),
+        primitive(primitive),
+        object(object),
+        t(hit.t)
+    {
     }
 };
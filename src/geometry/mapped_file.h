@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only file mapped into memory. The contents are paged in by the OS as
+// they are accessed, rather than being copied into a buffer up front.
+class MappedFile {
+public:
+    // The contents of the file, or nullptr if the file could not be mapped.
+    const char *data;
+    // The size of the file in bytes.
+    size_t size;
+
+    MappedFile(const char *path): data(nullptr), size(0) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                this->data = (const char*)mapped;
+                this->size = (size_t)st.st_size;
+            }
+        }
+
+        // The mapping stays valid after the file is closed.
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (this->data != nullptr) {
+            munmap((void*)this->data, this->size);
+        }
+    }
+
+    // return: whether the file was successfully mapped.
+    bool is_valid() const {
+        return this->data != nullptr;
+    }
+};
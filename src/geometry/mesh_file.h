@@ -0,0 +1,559 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <sys/stat.h>
+#include "primitives/mesh.h"
+#include "mapped_file.h"
+#include "bvh.h"
+
+using glm::vec3;
+using std::vector;
+using std::string;
+
+// Loads meshes from OBJ and binary PLY files into the indexed layout used by
+// Mesh. The first time a file is loaded, the parsed vertex and index buffers,
+// and the hierarchy built over the faces, are written to a cache file next to
+// it, named <path>.cache. Later loads map the cache directly into memory, so
+// no parsing is done and the hierarchy does not need to be rebuilt.
+class MeshFile {
+public:
+    // param path: the path to a .obj or .ply file.
+    // param shader: the shader given to every face of the mesh.
+    // return: the mesh in the file, along with a hierarchy over its faces.
+    //         The coordinates and winding are used as they are in the file.
+    static Mesh *load(const char *path, const Shader *shader) {
+        struct stat source_stat;
+        if (stat(path, &source_stat) != 0) {
+            printf("Unable to load mesh: %s\n", path);
+            exit(1);
+        }
+
+        const string cache_path = string(path) + ".cache";
+
+        Mesh *cached = MeshFile::load_cache(cache_path.c_str(), source_stat, shader);
+        if (cached != nullptr) {
+            return cached;
+        }
+
+        vector<vec3> vertices;
+        vector<int> indices;
+        MeshFile::parse(path, vertices, indices);
+
+        // An object needs at least one primitive to be bounded.
+        if (indices.empty()) {
+            printf("Unable to load mesh: %s\n", path);
+            exit(1);
+        }
+
+        Mesh *mesh = new Mesh(std::move(vertices), std::move(indices), shader);
+        mesh->bvh = new BVH(mesh->face_bounds());
+        MeshFile::write_cache(cache_path.c_str(), source_stat, *mesh);
+
+        return mesh;
+    }
+
+private:
+    // Placed at the start of a cache file. It is followed by the nodes of the
+    // hierarchy, the vertices as three floats each, the indices as 32 bit
+    // ints, then the indices of the faces in the hierarchy's leaves.
+    struct CacheHeader {
+        char magic[8];
+        // Used to detect caches written on a machine with a different byte
+        // order.
+        uint32_t byte_order;
+        uint32_t version;
+        // The size and modification time of the file the cache was made
+        // from. If either changes, the cache is rebuilt. The nanoseconds are
+        // kept so the file being rewritten within a second is noticed.
+        uint64_t source_size;
+        int64_t source_mtime;
+        int64_t source_mtime_nsec;
+        uint32_t num_vertices;
+        uint32_t num_indices;
+        uint32_t num_nodes;
+        // Used to detect caches written by a build with a different layout
+        // of the hierarchy.
+        uint32_t node_size;
+        // Pads the header so the buffers after it are aligned.
+        uint32_t padding[2];
+    };
+
+    static_assert(sizeof(vec3) == 3 * sizeof(float), "Vertices are mapped directly from the cache");
+    static_assert(sizeof(CacheHeader) % 16 == 0, "Buffers after the header should be aligned");
+
+    static constexpr const char *cache_magic = "RTMESH\0";
+    static constexpr uint32_t cache_byte_order = 0x01020304;
+    static constexpr uint32_t cache_version = 2;
+
+    // return: the header that a cache of the source file should have.
+    static CacheHeader make_header(const struct stat &source_stat, size_t num_vertices, size_t num_indices, size_t num_nodes) {
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, cache_magic, sizeof(header.magic));
+        header.byte_order = cache_byte_order;
+        header.version = cache_version;
+        header.source_size = (uint64_t)source_stat.st_size;
+        header.source_mtime = (int64_t)source_stat.st_mtime;
+        header.source_mtime_nsec = (int64_t)source_stat.st_mtim.tv_nsec;
+        header.num_vertices = (uint32_t)num_vertices;
+        header.num_indices = (uint32_t)num_indices;
+        header.num_nodes = (uint32_t)num_nodes;
+        header.node_size = sizeof(BVHWideNode);
+        return header;
+    }
+
+    // return: the mesh stored in the cache, or nullptr if there is no
+    //         cache, or it is out of date or corrupt.
+    static Mesh *load_cache(const char *cache_path, const struct stat &source_stat, const Shader *shader) {
+        MappedFile *file = new MappedFile(cache_path);
+
+        if (!file->is_valid() || file->size < sizeof(CacheHeader)) {
+            delete file;
+            return nullptr;
+        }
+
+        const CacheHeader *header = (const CacheHeader*)file->data;
+        const CacheHeader expected = MeshFile::make_header(source_stat, header->num_vertices, header->num_indices, header->num_nodes);
+
+        const size_t num_faces = header->num_indices / 3;
+        const size_t nodes_size = (size_t)header->num_nodes * sizeof(BVHWideNode);
+        const size_t vertices_size = (size_t)header->num_vertices * sizeof(vec3);
+        const size_t indices_size = (size_t)header->num_indices * sizeof(int);
+        const size_t items_size = num_faces * sizeof(int);
+
+        const bool is_valid = memcmp(header, &expected, sizeof(CacheHeader)) == 0
+                           && header->num_indices > 0 && header->num_indices % 3 == 0
+                           && file->size == sizeof(CacheHeader) + nodes_size + vertices_size + indices_size + items_size;
+
+        if (!is_valid) {
+            delete file;
+            return nullptr;
+        }
+
+        const char *nodes = file->data + sizeof(CacheHeader);
+        const vec3 *vertices = (const vec3*)(nodes + nodes_size);
+        const int *indices = (const int*)((const char*)vertices + vertices_size);
+        const int *items = (const int*)((const char*)indices + indices_size);
+
+        // The sizes match, but the contents may still be corrupt, so every
+        // index is checked before it is used.
+        for (size_t i=0; i<header->num_indices; i++) {
+            if (indices[i] < 0 || indices[i] >= (int)header->num_vertices) {
+                delete file;
+                return nullptr;
+            }
+        }
+
+        // The hierarchy is copied, rather than used in place, as it is owned
+        // by the object the mesh is given to.
+        vector<BVHWideNode> bvh_nodes(header->num_nodes);
+        memcpy((void*)bvh_nodes.data(), nodes, nodes_size);
+        BVH *bvh = new BVH(std::move(bvh_nodes), vector<int>(items, items + num_faces));
+
+        if (!bvh->is_valid((int)num_faces)) {
+            delete bvh;
+            delete file;
+            return nullptr;
+        }
+
+        Mesh *mesh = new Mesh(file, vertices, (int)header->num_vertices, indices, (int)header->num_indices, shader);
+        mesh->bvh = bvh;
+
+        return mesh;
+    }
+
+    // effect: writes the mesh and its hierarchy to the cache file. Failing to
+    //         write the cache is not an error, the mesh is just parsed again
+    //         next time.
+    static void write_cache(const char *cache_path, const struct stat &source_stat, const Mesh &mesh) {
+        // Written to a temporary file first, so a partially written cache is
+        // never loaded.
+        const string temp_path = string(cache_path) + ".tmp";
+
+        FILE *file = fopen(temp_path.c_str(), "wb");
+        if (file == NULL) {
+            return;
+        }
+
+        const vector<BVHWideNode> &nodes = mesh.bvh->nodes;
+        const vector<int> &items = mesh.bvh->item_indices;
+        const CacheHeader header = MeshFile::make_header(source_stat, mesh.num_vertices, mesh.num_indices, nodes.size());
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                    && fwrite(nodes.data(), sizeof(BVHWideNode), nodes.size(), file) == nodes.size()
+                    && fwrite(mesh.vertices, sizeof(vec3), mesh.num_vertices, file) == (size_t)mesh.num_vertices
+                    && fwrite(mesh.indices, sizeof(int), mesh.num_indices, file) == (size_t)mesh.num_indices
+                    && fwrite(items.data(), sizeof(int), items.size(), file) == items.size()
+                    && items.size() == (size_t)mesh.num_indices / 3;
+
+        written = fclose(file) == 0 && written;
+
+        if (!written || rename(temp_path.c_str(), cache_path) != 0) {
+            remove(temp_path.c_str());
+        }
+    }
+
+    // effect: fills the buffers with the mesh in the OBJ or PLY file.
+    static void parse(const char *path, vector<vec3> &vertices, vector<int> &indices) {
+        MappedFile file(path);
+        if (!file.is_valid()) {
+            printf("Unable to load mesh: %s\n", path);
+            exit(1);
+        }
+
+        const char *start = file.data;
+        const char *end = file.data + file.size;
+
+        const bool is_ply = end - start >= 3 && strncmp(start, "ply", 3) == 0;
+        const bool parsed = is_ply ? MeshFile::parse_ply(start, end, vertices, indices)
+                                   : MeshFile::parse_obj(start, end, vertices, indices);
+
+        if (!parsed) {
+            printf("Unable to parse mesh: %s\n", path);
+            exit(1);
+        }
+    }
+
+    // OBJ parsing.
+
+    // return: whether c separates tokens within a line.
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    // effect: moves p past spaces, stopping at the end of the line.
+    static void skip_spaces(const char *&p, const char *end) {
+        while (p < end && MeshFile::is_space(*p)) {
+            p++;
+        }
+    }
+
+    // effect: moves p to the start of the next line.
+    static void skip_line(const char *&p, const char *end) {
+        while (p < end && *p != '\n') {
+            p++;
+        }
+        if (p < end) {
+            p++;
+        }
+    }
+
+    // effect: copies the token at p into token, which is null terminated so
+    //         it can be converted with the C library. The mapped file is not
+    //         null terminated, so is not converted in place.
+    // return: whether there was a token before the end of the line.
+    static bool read_token(const char *&p, const char *end, char token[64]) {
+        MeshFile::skip_spaces(p, end);
+
+        int length = 0;
+        while (p < end && !MeshFile::is_space(*p) && *p != '\n') {
+            if (length < 63) {
+                token[length++] = *p;
+            }
+            p++;
+        }
+
+        token[length] = '\0';
+        return length > 0;
+    }
+
+    // return: whether the file was successfully parsed.
+    static bool parse_obj(const char *p, const char *end, vector<vec3> &vertices, vector<int> &indices) {
+        char token[64];
+        // The vertices of the face being read, which may have any number
+        // of sides.
+        vector<int> face;
+
+        while (p < end) {
+            MeshFile::skip_spaces(p, end);
+
+            if (end - p >= 2 && p[0] == 'v' && MeshFile::is_space(p[1])) {
+                p += 2;
+                vec3 vertex;
+
+                for (int axis=0; axis<3; axis++) {
+                    if (!MeshFile::read_token(p, end, token)) {
+                        return false;
+                    }
+                    vertex[axis] = strtof(token, NULL);
+                }
+
+                vertices.push_back(vertex);
+
+            } else if (end - p >= 2 && p[0] == 'f' && MeshFile::is_space(p[1])) {
+                p += 2;
+                face.clear();
+
+                // Each corner is of the form v, v/vt, v/vt/vn, or v//vn, and
+                // only v is used.
+                while (MeshFile::read_token(p, end, token)) {
+                    long index = strtol(token, NULL, 10);
+                    // Negative indices are relative to the end of the
+                    // vertices read so far.
+                    index = index < 0 ? (long)vertices.size() + index : index - 1;
+
+                    if (index < 0 || index >= (long)vertices.size()) {
+                        return false;
+                    }
+                    face.push_back((int)index);
+                }
+
+                MeshFile::triangulate(face, indices);
+            }
+
+            MeshFile::skip_line(p, end);
+        }
+
+        return true;
+    }
+
+    // effect: splits a convex polygon into triangles which share the first
+    //         vertex, and adds them to the indices.
+    static void triangulate(const vector<int> &face, vector<int> &indices) {
+        for (size_t i=1; i+1<face.size(); i++) {
+            indices.push_back(face[0]);
+            indices.push_back(face[i]);
+            indices.push_back(face[i + 1]);
+        }
+    }
+
+    // PLY parsing.
+
+    enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+    struct PlyProperty {
+        string name;
+        PlyType type;
+        // For list properties, the type of the count before the items.
+        PlyType count_type;
+        bool is_list;
+    };
+
+    struct PlyElement {
+        string name;
+        size_t count;
+        vector<PlyProperty> properties;
+    };
+
+    // return: the type with the given name in a PLY header.
+    static PlyType ply_type(const string &name) {
+        if (name == "char" || name == "int8") return PLY_INT8;
+        if (name == "uchar" || name == "uint8") return PLY_UINT8;
+        if (name == "short" || name == "int16") return PLY_INT16;
+        if (name == "ushort" || name == "uint16") return PLY_UINT16;
+        if (name == "int" || name == "int32") return PLY_INT32;
+        if (name == "uint" || name == "uint32") return PLY_UINT32;
+        if (name == "float" || name == "float32") return PLY_FLOAT32;
+        if (name == "double" || name == "float64") return PLY_FLOAT64;
+        return PLY_INVALID;
+    }
+
+    // return: the size in bytes of a value of the type.
+    static size_t ply_size(PlyType type) {
+        switch (type) {
+            case PLY_INT8: case PLY_UINT8: return 1;
+            case PLY_INT16: case PLY_UINT16: return 2;
+            case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+            case PLY_FLOAT64: return 8;
+            default: return 0;
+        }
+    }
+
+    // param swap: whether the value is stored with the opposite byte order
+    //             to this machine.
+    // return: the value at p, which must have enough bytes left.
+    static double read_ply_value(const char *p, PlyType type, bool swap) {
+        unsigned char bytes[8];
+        const size_t size = MeshFile::ply_size(type);
+
+        for (size_t i=0; i<size; i++) {
+            bytes[i] = p[swap ? size - 1 - i : i];
+        }
+
+        switch (type) {
+            case PLY_INT8:    { int8_t v;   memcpy(&v, bytes, 1); return v; }
+            case PLY_UINT8:   { uint8_t v;  memcpy(&v, bytes, 1); return v; }
+            case PLY_INT16:   { int16_t v;  memcpy(&v, bytes, 2); return v; }
+            case PLY_UINT16:  { uint16_t v; memcpy(&v, bytes, 2); return v; }
+            case PLY_INT32:   { int32_t v;  memcpy(&v, bytes, 4); return v; }
+            case PLY_UINT32:  { uint32_t v; memcpy(&v, bytes, 4); return v; }
+            case PLY_FLOAT32: { float v;    memcpy(&v, bytes, 4); return v; }
+            case PLY_FLOAT64: { double v;   memcpy(&v, bytes, 8); return v; }
+            default: return 0.0;
+        }
+    }
+
+    // effect: reads the PLY header, moving p to the start of the data.
+    // return: whether the header is valid, and the data is binary.
+    static bool parse_ply_header(const char *&p, const char *end, vector<PlyElement> &elements, bool &swap) {
+        char token[64];
+        bool has_format = false;
+
+        // The "ply" line.
+        MeshFile::skip_line(p, end);
+
+        while (p < end) {
+            if (!MeshFile::read_token(p, end, token)) {
+                MeshFile::skip_line(p, end);
+                continue;
+            }
+
+            const string keyword = token;
+
+            if (keyword == "end_header") {
+                MeshFile::skip_line(p, end);
+                return has_format;
+
+            } else if (keyword == "format") {
+                MeshFile::read_token(p, end, token);
+                const string format = token;
+                const uint32_t one = 1;
+                const bool is_little_endian = *(const char*)&one == 1;
+
+                if (format == "binary_little_endian") {
+                    swap = !is_little_endian;
+                } else if (format == "binary_big_endian") {
+                    swap = is_little_endian;
+                } else {
+                    // ASCII PLY files are not supported.
+                    return false;
+                }
+                has_format = true;
+
+            } else if (keyword == "element") {
+                PlyElement element;
+                MeshFile::read_token(p, end, token);
+                element.name = token;
+                MeshFile::read_token(p, end, token);
+                element.count = strtoul(token, NULL, 10);
+                elements.push_back(element);
+
+            } else if (keyword == "property") {
+                if (elements.empty()) {
+                    return false;
+                }
+
+                PlyProperty property;
+                MeshFile::read_token(p, end, token);
+                property.is_list = strcmp(token, "list") == 0;
+                property.count_type = PLY_INVALID;
+
+                if (property.is_list) {
+                    MeshFile::read_token(p, end, token);
+                    property.count_type = MeshFile::ply_type(token);
+                    MeshFile::read_token(p, end, token);
+                    if (property.count_type == PLY_INVALID) {
+                        return false;
+                    }
+                }
+
+                property.type = MeshFile::ply_type(token);
+                MeshFile::read_token(p, end, token);
+                property.name = token;
+
+                if (property.type == PLY_INVALID) {
+                    return false;
+                }
+                elements.back().properties.push_back(property);
+            }
+
+            MeshFile::skip_line(p, end);
+        }
+
+        return false;
+    }
+
+    // return: whether the file was successfully parsed.
+    static bool parse_ply(const char *p, const char *end, vector<vec3> &vertices, vector<int> &indices) {
+        vector<PlyElement> elements;
+        bool swap = false;
+
+        if (!MeshFile::parse_ply_header(p, end, elements, swap)) {
+            return false;
+        }
+
+        vector<int> face;
+
+        for (const PlyElement &element : elements) {
+            const bool is_vertex = element.name == "vertex";
+            const bool is_face = element.name == "face";
+
+            // Each record takes at least this many bytes, so a count which
+            // does not fit in the rest of the file, e.g. from a corrupt
+            // header, is rejected before any space is reserved for it.
+            size_t min_record_size = 0;
+            for (const PlyProperty &property : element.properties) {
+                min_record_size += MeshFile::ply_size(property.is_list ? property.count_type : property.type);
+            }
+            const size_t remaining = end - p;
+            if (min_record_size == 0 ? is_vertex && element.count > 0 : element.count > remaining / min_record_size) {
+                return false;
+            }
+
+            if (is_vertex) {
+                vertices.reserve(element.count);
+            }
+
+            for (size_t record=0; record<element.count; record++) {
+                vec3 vertex(0.0f);
+                face.clear();
+
+                for (const PlyProperty &property : element.properties) {
+                    size_t count = 1;
+
+                    if (property.is_list) {
+                        if ((size_t)(end - p) < MeshFile::ply_size(property.count_type)) {
+                            return false;
+                        }
+                        count = (size_t)MeshFile::read_ply_value(p, property.count_type, swap);
+                        p += MeshFile::ply_size(property.count_type);
+                    }
+
+                    const size_t size = MeshFile::ply_size(property.type);
+                    if ((size_t)(end - p) < count * size) {
+                        return false;
+                    }
+
+                    if (is_vertex && !property.is_list) {
+                        const int axis = property.name == "x" ? 0 : property.name == "y" ? 1 : property.name == "z" ? 2 : -1;
+                        if (axis >= 0) {
+                            vertex[axis] = (float)MeshFile::read_ply_value(p, property.type, swap);
+                        }
+                    }
+
+                    if (is_face && property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+                        for (size_t i=0; i<count; i++) {
+                            face.push_back((int)MeshFile::read_ply_value(p + i * size, property.type, swap));
+                        }
+                    }
+
+                    p += count * size;
+                }
+
+                if (is_vertex) {
+                    vertices.push_back(vertex);
+                }
+
+                if (is_face) {
+                    MeshFile::triangulate(face, indices);
+                }
+            }
+        }
+
+        // Checked once all elements are read, as the faces may come before
+        // the vertices.
+        for (int index : indices) {
+            if (index < 0 || index >= (int)vertices.size()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
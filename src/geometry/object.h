@@ -1,42 +1,127 @@
 #pragma once
 
 #include "primitives/primitive.h"
+#include "primitives/mesh.h"
+#include "bvh.h"
 #include <iostream>
+#include <limits>
+#include "projection.h"
 #include "../debugging.h"
 
+using glm::vec3;
+using glm::mat3;
+using glm::mat4;
+using glm::normalize;
 using std::vector;
 
 // A collection of primitives.
 //
+// An object can also be an instance of another object, its prototype, which
+// places the prototype's primitives somewhere else in the scene. Instances
+// share the primitives and hierarchy of their prototype, so repeating an
+// object many times only costs memory for the transform of each instance.
+//
 // WARNING: when the object is destroyed, the primitives it contains will also
-// be destroyed.
+// be destroyed, unless they are owned by an arena or the object is an
+// instance.
 class Object {
 public:
     const int num_prims;
     Primitive **primitives;
+    // The mesh the primitives belong to, or nullptr if the primitives were
+    // allocated individually.
+    Mesh *const mesh;
+    // Whether the primitives are destroyed with the object. False if they
+    // are owned by an arena, e.g. that of a SceneBuilder, or by a prototype.
+    const bool owns_primitives;
+    // A box around the primitives, in the coordinates of the object.
     const BoundingCube bounding_cube;
+    // Hierarchy over the primitives of the object, i.e. the bottom level of
+    // the scene's acceleration structure. Built in the coordinates of the
+    // object, so it does not change when the object is moved.
+    const BVH *const bvh;
+    // The object whose primitives and hierarchy this object shares, or
+    // nullptr if this object is not an instance.
+    const Object *const prototype;
+
+private:
+    // Transforms points from the coordinates of the object to those of the
+    // scene, and back.
+    mat4 to_world = mat4(1.0f);
+    mat4 to_object = mat4(1.0f);
+    // Whether the transform is anything other than the identity. Most
+    // objects are created in place, so they skip transforming rays.
+    bool is_transformed = false;
+
+public:
 
     Object(const int num_prims, Primitive **primitives):
-        num_prims(num_prims),
-        primitives(primitives),
-        bounding_cube(Object::make_bounding_cube(num_prims, primitives))
+        Object(num_prims, primitives, nullptr, true)
     {
-        for (int i=0; i<num_prims; i++) {
-            this->primitives[i]->parent_obj = this;
-        }
+    }
+
+    // param owns_primitives: whether to destroy the primitives with the
+    //                        object. The array of primitives is always
+    //                        destroyed.
+    Object(const int num_prims, Primitive **primitives, bool owns_primitives):
+        Object(num_prims, primitives, nullptr, owns_primitives)
+    {
+    }
+
+    // param mesh: the mesh whose faces make up the object.
+    Object(Mesh *mesh):
+        Object(mesh->num_faces(), mesh->make_primitives(), mesh, true)
+    {
+    }
+
+    // param prototype: the object to make an instance of. Instancing an
+    //                  instance makes another instance of its prototype.
+    // param transform: the transform from the coordinates the prototype was
+    //                  created in to the scene's. The transform of the
+    //                  prototype itself is not included.
+    //
+    // WARNING: the prototype must outlive its instances.
+    Object(const Object *prototype, const mat4 &transform):
+        num_prims(prototype->num_prims),
+        primitives(prototype->primitives),
+        mesh(prototype->mesh),
+        owns_primitives(false),
+        bounding_cube(prototype->bounding_cube),
+        bvh(prototype->bvh),
+        prototype(&prototype->geometry())
+    {
+        this->set_transform(transform);
     }
 
     ~Object() {
-        for (int i=0; i<num_prims; i++) {
-            delete this->primitives[i];
+        if (this->prototype != nullptr) {
+            // Everything is owned by the prototype.
+            return;
+        }
+
+        delete this->bvh;
+
+        if (this->mesh != nullptr) {
+            // The faces are owned by the mesh.
+            delete this->mesh;
+        } else if (this->owns_primitives) {
+            for (int i=0; i<num_prims; i++) {
+                delete this->primitives[i];
+            }
         }
 
         delete[] this->primitives;
     }
 
+    // return: the object which owns the primitives and hierarchy of this
+    //         object, i.e. its prototype if it is an instance.
+    const Object &geometry() const {
+        return this->prototype != nullptr ? *this->prototype : *this;
+    }
+
     // return: the center point of the object in world coordinates.
     vec4 center() const {
-        return bounding_cube.center;
+        return this->point_to_world(bounding_cube.center);
     }
 
     // return: the world_point converted to in the axis aligned coordinate
@@ -45,6 +130,7 @@ public:
     vec4 converted_world_to_obj(vec4 world_point) const {
         vec4 min = this->bounding_cube.min;
         vec4 max = this->bounding_cube.max;
+        world_point = this->point_to_object(world_point);
 
         // Multipliers to convert from world coordinates to object coordinates.
         float mx = 1 / (max.x - min.x);
@@ -56,20 +142,165 @@ public:
         return (world_point - this->bounding_cube.min) * scale;
     }
 
+    // return: the transform from the coordinates of the object to those of
+    //         the scene.
+    const mat4 &transform() const {
+        return this->to_world;
+    }
+
+    // return: whether the object has been moved from where it was created.
+    bool has_transform() const {
+        return this->is_transformed;
+    }
+
+    // effect: places the object in the scene using the transform from its
+    //         coordinates to those of the scene. This can be any affine
+    //         transform, e.g. a rotation or a non-uniform scale.
+    //
+    // WARNING: objects in a scene must be moved using
+    // Scene::transform_object, so the scene's hierarchy stays up to date.
+    void set_transform(const mat4 &transform) {
+        this->to_world = transform;
+        this->to_object = glm::inverse(transform);
+        this->is_transformed = transform != mat4(1.0f);
+    }
+
+    // return: the ray in the coordinates of the object. The direction is not
+    //         normalised, so distances along the ray are the same in both
+    //         coordinates.
+    Ray ray_to_object(const Ray &ray) const {
+        Ray local = ray;
+        local.start = vec3(this->to_object * vec4(ray.start, 1.0f));
+        local.dir = mat3(this->to_object) * ray.dir;
+        return local;
+    }
+
+    // return: the point converted between the coordinates of the scene and
+    //         the object.
+    vec4 point_to_object(vec4 point) const {
+        if (!this->is_transformed) {
+            return point;
+        }
+        return vec4(vec3(this->to_object * vec4(vec3(point), 1.0f)), point.w);
+    }
+
+    vec4 point_to_world(vec4 point) const {
+        if (!this->is_transformed) {
+            return point;
+        }
+        return vec4(vec3(this->to_world * vec4(vec3(point), 1.0f)), point.w);
+    }
+
+    // return: the normalised normal in the coordinates of the scene, of a
+    //         surface with the given normal in the coordinates of the object.
+    vec3 normal_to_world(vec3 normal) const {
+        if (!this->is_transformed) {
+            return normal;
+        }
+        // Normals are transformed by the inverse transpose, so they stay
+        // perpendicular to surfaces which are scaled.
+        return normalize(glm::transpose(mat3(this->to_object)) * normal);
+    }
+
+    // param prim: one of the primitives of the object.
+    // param point: a point on the primitive, in the coordinates of the scene.
+    // return: the normal to the primitive at the point, in the coordinates
+    //         of the scene. The same primitive can have different normals
+    //         in each instance of an object.
+    vec4 normal_at(const Primitive *prim, vec4 point) const {
+        if (!this->is_transformed) {
+            return prim->local_normal_at(point);
+        }
+
+        const vec4 local_normal = prim->local_normal_at(this->point_to_object(point));
+        return vec4(this->normal_to_world(vec3(local_normal)), local_normal.w);
+    }
+
+    // return: a box around the object in the coordinates of the scene.
+    BoundingCube world_bounding_cube() const {
+        if (!this->is_transformed) {
+            return this->bounding_cube;
+        }
+
+        vec3 min = vec3(std::numeric_limits<float>::max());
+        vec3 max = vec3(-std::numeric_limits<float>::max());
+
+        // The box around the transformed corners of the object's box.
+        for (int corner=0; corner<8; corner++) {
+            const vec3 local = vec3(corner & 1 ? this->bounding_cube.max.x : this->bounding_cube.min.x,
+                                    corner & 2 ? this->bounding_cube.max.y : this->bounding_cube.min.y,
+                                    corner & 4 ? this->bounding_cube.max.z : this->bounding_cube.min.z);
+            const vec3 world = vec3(this->to_world * vec4(local, 1.0f));
+            min = glm::min(min, world);
+            max = glm::max(max, world);
+        }
+
+        return BoundingCube(project_to_4D(min), project_to_4D(max));
+    }
+
+    // param max_dist: the distance beyond which primitives are skipped. This
+    //                 may be shrunk by visit_prim as closer intersections
+    //                 are found.
+    // param ray: a ray in the coordinates of the object.
+    // param visit_prim: called with the index of each primitive which is
+    //                   close enough to the ray that it may intersect it.
+    // effect: visits the primitives which may intersect the ray, nearest first.
+    template<typename F>
+    void traverse(const Ray &ray, const float &max_dist, F visit_prim) const {
+        this->bvh->traverse(ray, max_dist, visit_prim);
+    }
+
 private:
+    Object(const int num_prims, Primitive **primitives, Mesh *mesh, bool owns_primitives):
+        num_prims(num_prims),
+        primitives(primitives),
+        mesh(mesh),
+        owns_primitives(owns_primitives),
+        bounding_cube(Object::make_bounding_cube(num_prims, primitives)),
+        bvh(Object::make_bvh(num_prims, primitives, mesh)),
+        prototype(nullptr)
+    {
+    }
+
+    // return: the hierarchy over the primitives, which is taken from the mesh
+    //         if it already has one.
+    static BVH *make_bvh(const int num_prims, Primitive **primitives, Mesh *mesh) {
+        if (mesh != nullptr && mesh->bvh != nullptr) {
+            return new BVH(std::move(*mesh->bvh));
+        }
+        return new BVH(Object::primitive_bounds(num_prims, primitives));
+    }
+
+    // return: the bounding cubes of the primitives, used to build the BVH.
+    static vector<BoundingCube> primitive_bounds(const int num_prims, Primitive **primitives) {
+        vector<BoundingCube> bounds;
+
+        for (int i=0; i<num_prims; i++) {
+            bounds.push_back(primitives[i]->bounding_cube());
+        }
+
+        return bounds;
+    }
+
     // return: a bounding box around all the primtives.
     static BoundingCube make_bounding_cube(const int num_prims, Primitive **primitives) {
+        if (num_prims == 0) {
+            return BoundingCube(vec4(0, 0, 0, 1), vec4(0, 0, 0, 1));
+        }
+
         // Initialise the min and max, these will be updated below.
-		vec4 min = primitives[0]->bounding_cube.min;
-		vec4 max = primitives[0]->bounding_cube.max;
+		vec4 min = primitives[0]->bounding_cube().min;
+		vec4 max = primitives[0]->bounding_cube().max;
 
 		for (int i=1; i<num_prims; i++) {
-			if (primitives[i]->bounding_cube.min.x < min.x) min.x = primitives[i]->bounding_cube.min.x;
-			if (primitives[i]->bounding_cube.min.y < min.y) min.y = primitives[i]->bounding_cube.min.y;
-			if (primitives[i]->bounding_cube.min.z < min.z) min.z = primitives[i]->bounding_cube.min.z;
-			if (primitives[i]->bounding_cube.max.x > max.x) max.x = primitives[i]->bounding_cube.max.x;
-			if (primitives[i]->bounding_cube.max.y > max.y) max.y = primitives[i]->bounding_cube.max.y;
-			if (primitives[i]->bounding_cube.max.z > max.z) max.z = primitives[i]->bounding_cube.max.z;
+			const BoundingCube prim_cube = primitives[i]->bounding_cube();
+
+			if (prim_cube.min.x < min.x) min.x = prim_cube.min.x;
+			if (prim_cube.min.y < min.y) min.y = prim_cube.min.y;
+			if (prim_cube.min.z < min.z) min.z = prim_cube.min.z;
+			if (prim_cube.max.x > max.x) max.x = prim_cube.max.x;
+			if (prim_cube.max.y > max.y) max.y = prim_cube.max.y;
+			if (prim_cube.max.z > max.z) max.z = prim_cube.max.z;
 		}
 
 		return BoundingCube(min, max);
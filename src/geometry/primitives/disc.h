@@ -15,33 +15,37 @@ public:
     const vec4 center;
 
     Disc(float inner_r, float outer_r, vec4 normal_dir, vec4 center, const Shader *shader):
-        Primitive(shader, Disc::make_bounding_cube(center, outer_r)),
+        Primitive(shader),
         inner_r(inner_r), outer_r(outer_r), normal_dir(glm::normalize(normal_dir)), center(center) {
     };
 
-    // return: the position of the intersection with the primitive, or nullptr
-    //		   if no intersection occurred.
-    optional<vec4> intersection(const Ray &ray) const {
+    bool intersect(const Ray &ray, float t_min, float t_max, Hit &hit) const override {
+        return Disc::solve_intersection(ray, vec3(this->center), vec3(this->normal_dir), this->inner_r, this->outer_r, t_min, t_max, hit);
+    }
+
+    // param center, normal: the center of the disc and the direction it faces.
+    // param inner_r, outer_r: the radii between which the disc is drawn.
+    // return: whether the ray hits the disc within the interval, in which case
+    //         hit is filled in.
+    static bool solve_intersection(const Ray &ray, vec3 center, vec3 normal, float inner_r, float outer_r, float t_min, float t_max, Hit &hit) {
         // With help from the equations from the link below for a plane and disc.
         //  https://www.cl.cam.ac.uk/teaching/1999/AGraphHCI/SMAG/node2.html#eqn:vectray
 
-        vec3 normal_3d = vec3(this->normal_dir);
-        vec3 ray_dir_3d = vec3(ray.dir);
+        vec3 ray_dir_3d = ray.dir;
 
-        vec3 ray_offset_3d = vec3(this->center - ray.start);
-        float n_dot_offset = glm::dot(normal_3d, ray_offset_3d);
-        float n_dot_d = glm::dot(normal_3d, ray_dir_3d);
+        vec3 ray_offset_3d = center - ray.start;
+        float n_dot_offset = glm::dot(normal, ray_offset_3d);
+        float n_dot_d = glm::dot(normal, ray_dir_3d);
 
         float t = n_dot_offset / n_dot_d;
 
-        // The disc is behind the start of the ray.
-        if (t < 0) {
-            return nullopt;
+        // The disc is outside the interval, e.g. behind the start of the ray.
+        if (!(t_min < t && t <= t_max)) {
+            return false;
         }
 
-        vec4 intersection = ray.start + (t * ray.dir);
-        vec4 intersection_offset = intersection - this->center;
-        vec3 offset_3d = vec3(intersection_offset);
+        vec3 intersection = ray.at(t);
+        vec3 offset_3d = intersection - center;
 
         // The squared distance from the center of the disc to the intersection
         // point.
@@ -50,17 +54,22 @@ public:
         // If the square distance is within the square radii then the
         // intersection occurred within the disc.
         if (inner_r * inner_r <= sq_dist && sq_dist <= outer_r * outer_r) {
-            return intersection;
+            hit.t = t;
+            return true;
         }
 
-        return nullopt;
+        return false;
     }
 
     // return: the normal to the primtive at the given point on the primitive.
-    vec4 normal_at(vec4 point) const {
+    vec4 local_normal_at(vec4 point) const override {
         return normal_dir;
     }
 
+    BoundingCube bounding_cube() const override {
+        return Disc::make_bounding_cube(this->center, this->outer_r);
+    }
+
 private:
     // return: the minimum and maximum corners of bounding box around the torus.
     static BoundingCube make_bounding_cube(vec4 center, float outer_r) {
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <utility>
+#include "primitive.h"
+#include "triangle.h"
+#include "../mapped_file.h"
+#include "../bvh.h"
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using std::vector;
+
+// A face of a mesh. Unlike Triangle, the vertices are not stored in the face,
+// instead they are looked up in the vertex buffer shared by the whole mesh.
+class MeshTriangle : public Primitive {
+public:
+    // The vertex buffer of the mesh the face belongs to.
+    const vec3 *vertices;
+    // The three indices, into vertices, of the corners of the face.
+    const int *indices;
+
+    MeshTriangle(const vec3 *vertices, const int *indices, const Shader *shader):
+        Primitive(shader), vertices(vertices), indices(indices)
+    {
+    }
+
+    bool intersect(const Ray &ray, float t_min, float t_max, Hit &hit) const override {
+        return MeshTriangle::intersect_face(ray, this->vertices, this->indices, t_min, t_max, hit);
+    }
+
+    // param vertices: the vertex buffer of the mesh.
+    // param indices: the three indices of the corners of the face.
+    // return: whether the ray hits the face within the interval, in which
+    //         case hit is filled in.
+    static bool intersect_face(const Ray &ray, const vec3 *vertices, const int *indices, float t_min, float t_max, Hit &hit) {
+        const vec3 v0 = vertices[indices[0]];
+        const vec3 e1 = vertices[indices[1]] - v0;
+        const vec3 e2 = vertices[indices[2]] - v0;
+
+        // The normal is computed per test rather than stored, to keep each
+        // face small.
+        const vec3 e1_cross_e2 = cross(e1, e2);
+        optional<vec3> tuv = Triangle::solve_intersection(ray, v0, e1, e2, e1_cross_e2);
+
+        if (!tuv.has_value() || tuv->x <= t_min || tuv->x > t_max) {
+            return false;
+        }
+
+        hit.t = tuv->x;
+        return true;
+    }
+
+    vec4 local_normal_at(vec4 point) const override {
+        const vec3 v0 = this->vertices[this->indices[0]];
+        const vec3 e1 = this->vertices[this->indices[1]] - v0;
+        const vec3 e2 = this->vertices[this->indices[2]] - v0;
+
+        // Matches the winding used by Triangle.
+        return project_to_4D(normalize(cross(e2, e1)));
+    }
+
+    BoundingCube bounding_cube() const override {
+        const vec3 v0 = this->vertices[this->indices[0]];
+        const vec3 v1 = this->vertices[this->indices[1]];
+        const vec3 v2 = this->vertices[this->indices[2]];
+
+        return BoundingCube(project_to_4D(glm::min(glm::min(v0, v1), v2)),
+                            project_to_4D(glm::max(glm::max(v0, v1), v2)));
+    }
+};
+
+// A triangle mesh where the faces share vertices, e.g. a model loaded from a
+// file. The faces are allocated together, rather than one at a time, so large
+// meshes use less memory and are more cache friendly than separate Triangles.
+//
+// WARNING: the faces point into the mesh's buffers, so the mesh must not be
+// destroyed while the faces are in use. When given to an Object, the object
+// takes ownership of the mesh.
+class Mesh {
+private:
+    // Storage for the buffers when they are not mapped from a file. These are
+    // declared first as the public pointers below point into them.
+    vector<vec3> vertex_storage;
+    vector<int> index_storage;
+    // The file the buffers are mapped from, or nullptr.
+    MappedFile *mapping;
+
+public:
+    // The positions of the vertices, shared between faces.
+    const vec3 *const vertices;
+    const int num_vertices;
+    // Three indices into vertices per face.
+    const int *const indices;
+    const int num_indices;
+    // A hierarchy over the faces, e.g. loaded along with the mesh, or nullptr.
+    // When the mesh is given to an Object, this is used rather than building
+    // a new hierarchy.
+    BVH *bvh = nullptr;
+
+    // param indices: three indices into vertices for each face, listed so
+    //                the faces wind the same way as Triangle.
+    Mesh(vector<vec3> vertices, vector<int> indices, const Shader *shader):
+        vertex_storage(std::move(vertices)),
+        index_storage(std::move(indices)),
+        mapping(nullptr),
+        vertices(this->vertex_storage.data()),
+        num_vertices((int)this->vertex_storage.size()),
+        indices(this->index_storage.data()),
+        num_indices((int)this->index_storage.size()),
+        faces(Mesh::make_faces(this->vertices, this->indices, this->num_indices, shader))
+    {
+    }
+
+    // param mapping: the file containing the buffers, of which the mesh
+    //                takes ownership. This avoids copying the buffers.
+    // param vertices, indices: pointers into the mapped file.
+    Mesh(MappedFile *mapping, const vec3 *vertices, int num_vertices, const int *indices, int num_indices, const Shader *shader):
+        mapping(mapping),
+        vertices(vertices),
+        num_vertices(num_vertices),
+        indices(indices),
+        num_indices(num_indices),
+        faces(Mesh::make_faces(vertices, indices, num_indices, shader))
+    {
+    }
+
+    Mesh(const Mesh&) = delete;
+    Mesh &operator=(const Mesh&) = delete;
+
+    ~Mesh() {
+        delete this->bvh;
+        delete this->mapping;
+    }
+
+    // return: the number of triangles in the mesh.
+    int num_faces() const {
+        return (int)this->faces.size();
+    }
+
+    // return: the bounding cube of each face, used to build a hierarchy over
+    //         the faces.
+    vector<BoundingCube> face_bounds() const {
+        vector<BoundingCube> bounds;
+        bounds.reserve(this->faces.size());
+
+        for (const MeshTriangle &face : this->faces) {
+            bounds.push_back(face.bounding_cube());
+        }
+
+        return bounds;
+    }
+
+    // return: a newly allocated array of pointers to each face, as used to
+    //         construct an Object.
+    Primitive **make_primitives() {
+        Primitive **primitives = new Primitive*[this->faces.size()];
+
+        for (size_t i=0; i<this->faces.size(); i++) {
+            primitives[i] = &this->faces[i];
+        }
+
+        return primitives;
+    }
+
+private:
+    // The faces, stored contiguously.
+    vector<MeshTriangle> faces;
+
+    // return: a face for every three indices, referencing the buffers of
+    //         the mesh.
+    static vector<MeshTriangle> make_faces(const vec3 *vertices, const int *indices, int num_indices, const Shader *shader) {
+        vector<MeshTriangle> faces;
+        faces.reserve(num_indices / 3);
+
+        for (int i=0; i+2<num_indices; i+=3) {
+            faces.push_back(MeshTriangle(vertices, &indices[i], shader));
+        }
+
+        return faces;
+    }
+};
@@ -14,20 +14,21 @@ using std::optional;
 class Shader;
 class Object;
 
+// Where a ray hit a primitive. This is kept small as a hit is recorded for
+// every primitive that is closer than the closest found so far.
+struct Hit {
+	// The distance to the hit, in multiples of the ray's direction.
+	float t;
+};
+
 // WARNING: When the primtive is destroyed, the shader is contains will
 // also be destroyed.
 class Primitive {
 public:
 	// Used to tell the color of the triangle.
 	const Shader *shader;
-	// The smallest cube that encloses the primtitive.
-	const BoundingCube bounding_cube;
-	// The object that the primitive belongs to. This is set by the object
-	// when the object is initialised.
-	Object *parent_obj = NULL;
-
-    Primitive(const Shader *shader, BoundingCube bounding_cube):
-		shader(shader), bounding_cube(bounding_cube) {
+
+    Primitive(const Shader *shader): shader(shader) {
 	};
 
 	virtual ~Primitive() {
@@ -35,10 +36,22 @@ public:
 		//delete this->shader;
 	}
 
-	// return: the position of the intersection with the primitive, or nullptr
-	//		   if no intersection occurred.
-	virtual optional<vec4> intersection(const Ray &ray) const = 0;
-
-	// return: the normal to the primtive at the given point on the primitive.
-    virtual vec4 normal_at(vec4 point) const = 0;
+	// param t_min, t_max: the interval, in multiples of the ray's direction,
+	//					   in which to look for a hit. Hits at exactly t_max
+	//					   are reported, so ties with the closest hit found
+	//					   so far can be broken by the caller.
+	// param hit: set to the hit, only if there is one in the interval.
+	// return: whether the ray hits the primitive in (t_min, t_max].
+	virtual bool intersect(const Ray &ray, float t_min, float t_max, Hit &hit) const = 0;
+
+	// return: the normal to the primitive at the given point, both in the
+	//		   coordinates of the primitive's object, i.e. the coordinates
+	//		   the primitive was created in. Object::normal_at gives the
+	//		   normal in scene coordinates.
+    virtual vec4 local_normal_at(vec4 point) const = 0;
+
+	// return: the smallest cube that encloses the primitive. This is computed
+	//		   rather than stored, as it is only needed to build the object's
+	//		   hierarchy, and storing it would make every primitive larger.
+	virtual BoundingCube bounding_cube() const = 0;
 };
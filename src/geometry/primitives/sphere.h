@@ -6,6 +6,7 @@
 #include "../linear_alg.h"
 #include <math.h>
 
+using glm::vec2;
 using glm::vec3;
 using glm::vec4;
 using glm::normalize;
@@ -18,27 +19,43 @@ public:
     float radius;
 
     Sphere(vec4 center, float radius, const Shader* shader):
-        Primitive(shader, Sphere::make_bounding_cube(center, radius)),
+        Primitive(shader),
         center(center),
         radius(radius)
     {
     }
 
-	virtual optional<vec4> intersection(const Ray &ray) const override {
-        vec3 orig = vec3(ray.start);
-        vec3 dir = vec3(ray.normalized_dir);
+	virtual bool intersect(const Ray &ray, float t_min, float t_max, Hit &hit) const override {
+        return Sphere::solve_intersection(ray, vec3(this->center), this->radius, t_min, t_max, hit);
+    }
+
+    // param center, radius: the sphere to intersect with.
+    // return: whether the ray hits the sphere within the interval, in which
+    //         case hit is filled in. Shared with the compiled representation
+    //         of the scene, which does not store Spheres.
+    static bool solve_intersection(const Ray &ray, vec3 center, float radius, float t_min, float t_max, Hit &hit) {
+        vec3 orig = ray.start;
+        const float dir_length = glm::length(ray.dir);
+        vec3 dir = ray.dir / dir_length;
         float radius2 = radius * radius;
 
         //Computing inside of sqrt
-        vec3 L = vec3(center) - orig;
+        vec3 L = center - orig;
 
         const float *source_L = (const float*)glm::value_ptr(L);
         const float *source_dir = (const float*)glm::value_ptr(dir);
 
         float tca = dot(source_L, source_dir);
-        float d2 = dot(source_L, source_L) - tca * tca;
+
+        // The squared distance from the center to the closest point on the
+        // ray. This is found from the offset to the closest point, rather than
+        // as |L|^2 - tca^2, which loses precision when the sphere is small
+        // compared to its distance, e.g. a distant star.
+        vec3 perp = L - tca * dir;
+        const float *source_perp = (const float*)glm::value_ptr(perp);
+        float d2 = dot(source_perp, source_perp);
         if (d2 > radius2) { //cannot compute sqrt of negative number
-            return nullopt;
+            return false;
         }
 
         //Computing intersection points
@@ -51,22 +68,34 @@ public:
             std::swap(t0, t1); //pick the closer intersection
         }
 
-        if (t0 < 0) {
-            t0 = t1; // if t0 is negative, let's use t1 instead
-            if (t0 < 0) {
-                //printf("points outside scene\n");
-                return nullopt; // both t0 and t1 are negative
+        // The distances above are along the normalised direction, whereas
+        // the interval is in multiples of the ray's direction.
+        const float norm_t_min = t_min * dir_length;
+        const float norm_t_max = t_max * dir_length;
+
+        if (t0 <= norm_t_min) {
+            t0 = t1; // if t0 is before the interval, let's use t1 instead
+            if (t0 <= norm_t_min) {
+                return false; // both t0 and t1 are before the interval
             }
         }
-        float t = t0;
 
-        return project_to_4D(vec3(ray.start) + (t * dir));
+        if (t0 > norm_t_max) {
+            return false;
+        }
+
+        hit.t = t0 / dir_length;
+        return true;
     }
 
-    virtual vec4 normal_at(vec4 point) const override {
+    virtual vec4 local_normal_at(vec4 point) const override {
         return normalize(point - center);
     }
 
+    virtual BoundingCube bounding_cube() const override {
+        return Sphere::make_bounding_cube(this->center, this->radius);
+    }
+
 private:
     // return: the minimum and maximum corners of bounding box around the
     //         sphere.
@@ -4,11 +4,12 @@
 #include "primitive.h"
 #include "../linear_alg.h"
 
+using glm::vec2;
 using glm::vec3;
 using glm::vec4;
 using glm::normalize;
 using glm::cross;
-using glm::mat3;
+using glm::dot;
 using std::optional;
 using std::nullopt;
 
@@ -23,51 +24,88 @@ public:
     const vec3 e1, e2;
     // Precomputed properties of the triangle.
     const vec4 normal;
+    // The unnormalised normal e1 x e2, used to solve for intersections
+    // without inverting a matrix per ray.
+    const vec3 e1_cross_e2;
 
 	Triangle(vec4 v0, vec4 v1, vec4 v2, const Shader *shader):
-		Primitive(shader, Triangle::make_bounding_cube(v0, v1, v2)),
+		Primitive(shader),
 		v0(v0), v1(v1), v2(v2),
 		e1(vec3(v1 - v0)),
 		e2(vec3(v2 - v0)),
-		normal(project_to_4D(normalize(cross(e2, e1))))
+		normal(project_to_4D(normalize(cross(e2, e1)))),
+		e1_cross_e2(cross(e1, e2))
 	{
 	}
 
-	optional<vec4> intersection(const Ray &ray) const override {
-        vec3 b = vec3(ray.start - v0);
-        mat3 A = mat3(-vec3(ray.dir), e1, e2);
-		vec3 intersection_in_plane_coordinates = inverse(A) * b;
-		//vec3 intersection_in_plane_coordinates = solve_linear(A, b);
+	bool intersect(const Ray &ray, float t_min, float t_max, Hit &hit) const override {
+		optional<vec3> tuv = this->plane_coordinates_of_intersection(ray);
 
-		if(!is_inside(intersection_in_plane_coordinates)) {
-			return nullopt;
+		if (!tuv.has_value() || tuv->x <= t_min || tuv->x > t_max) {
+			return false;
 		}
-        return in_scene_coordinates(intersection_in_plane_coordinates);
-    }
 
-    vec4 normal_at(vec4 point) const override {
-        return normal;
+		hit.t = tuv->x;
+		return true;
     }
 
-private:
-	// return: whether the point [t u v], in the triangle's coordinate system
-	//		   (i.e. e1 and e2 are the basis vectors), is inside the triangle
-	bool is_inside(vec3 pos) const {
-		float t = pos.x;
-		float u = pos.y;
-		float v = pos.z;
-
-		return 0.0f < t && 0.0f <= u && 0.0f <= v && u + v <= 1.0f;
+	// return: the intersection as [t u v], where t is the distance along the
+	//		   ray in multiples of its direction, and u and v are the
+	//		   barycentric coordinates along e1 and e2. Or nullopt if the
+	//		   ray misses the triangle.
+	optional<vec3> plane_coordinates_of_intersection(const Ray &ray) const {
+		return Triangle::solve_intersection(ray, vec3(this->v0), this->e1, this->e2, this->e1_cross_e2);
 	}
 
-	// return: a point [t u v], in the triangle's coordinate system (i.e. e1
-	//		   and e2 are the basis vectors) into the world coordinate system.
-	vec4 in_scene_coordinates(vec3 point) const {
-        float u = point.y;
-        float v = point.z;
-        return project_to_4D(vec3(v0) + u * e1 + v * e2);
+	// param v0: the first vertex of the triangle.
+	// param e1, e2: the edges from v0 to the other two vertices.
+	// param e1_cross_e2: the unnormalised normal of the triangle.
+	// return: the intersection of the ray with the triangle as [t u v], or
+	//		   nullopt if the ray misses. Shared with triangles that do not
+	//		   store their own vertices, e.g. those in a mesh.
+	static optional<vec3> solve_intersection(const Ray &ray, vec3 v0, vec3 e1, vec3 e2, vec3 e1_cross_e2) {
+		// Solves start + t*dir = v0 + u*e1 + v*e2 using Cramer's rule, as in
+		// Moller-Trumbore, except the normal is passed in so only one cross
+		// product is needed per ray.
+		const vec3 dir = ray.dir;
+		const vec3 b = ray.start - v0;
+		const vec3 q = cross(dir, b);
+
+		// Each of t, u, and v is a numerator divided by det. The division is
+		// only done once the ray is known to hit the triangle.
+		float det = dot(dir, e1_cross_e2);
+		float t = -dot(b, e1_cross_e2);
+		float u = dot(e2, q);
+		float v = -dot(e1, q);
+
+		// Make det positive, so the inequalities below do not depend on
+		// which side of the triangle the ray hits.
+		if (det < 0.0f) {
+			det = -det;
+			t = -t;
+			u = -u;
+			v = -v;
+		}
+
+		// A det of zero means the ray is parallel to the triangle, or the
+		// triangle is degenerate.
+		if (!(det > 0.0f && 0.0f < t && 0.0f <= u && 0.0f <= v && u + v <= det)) {
+			return nullopt;
+		}
+
+		const float inv_det = 1.0f / det;
+		return vec3(t * inv_det, u * inv_det, v * inv_det);
 	}
 
+    vec4 local_normal_at(vec4 point) const override {
+        return normal;
+    }
+
+    BoundingCube bounding_cube() const override {
+        return Triangle::make_bounding_cube(this->v0, this->v1, this->v2);
+    }
+
+private:
 	// return: the minimum and maximum corners of bounding cube around the
 	//		   triangle.
 	static BoundingCube make_bounding_cube(vec4 v0, vec4 v1, vec4 v2) {
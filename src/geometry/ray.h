@@ -1,42 +1,55 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <stdexcept>
+#include <limits>
 
+using glm::vec3;
 using glm::vec4;
-using std::runtime_error;
 
+// Kept small, as rays are made for every bounce, shadow ray, and step
+// through a volume. Values derived from the direction, e.g. its inverse for
+// testing against boxes, are computed by the code which needs them, e.g.
+// BoxTestRay.
 class Ray {
 public:
     // The start position of the ray.
-    const vec4 start;
-    // The direction of the ray.
-    const vec4 dir;
-    // The inverse of the direction ray, i.e. 1/dir. This is precalculated for
-    // the ray-bounding cube collision calculations.
-    const vec4 inv_dir;
-    // The normalised direction. The is precalculated here to avoid it being
-    // recalculated later.
-    const vec4 normalized_dir;
+    vec3 start;
+    // The direction of the ray, which is not normalised. Distances along the
+    // ray are in multiples of the direction.
+    vec3 dir;
+    // Only intersections from t_min up to, but not including, t_max along the
+    // ray are found, e.g. shadow rays end at the light.
+    float t_min;
+    float t_max;
     // The number of bounces the ray has remaining. Once this reaches zero the
     // ray should no longer be used.
-    const int bounces_remaining;
+    int bounces_remaining;
 
-    Ray(vec4 start, vec4 dir, int bounces_remaining):
-        start(start), dir(dir), inv_dir(1.0f/dir), normalized_dir(glm::normalize(dir)), bounces_remaining(bounces_remaining)
+    Ray(vec3 start, vec3 dir, int bounces_remaining, float t_max = std::numeric_limits<float>::max()):
+        start(start), dir(dir), t_min(0.0f), t_max(t_max), bounces_remaining(bounces_remaining)
     {
-        if (bounces_remaining < 0) {
-            throw std::runtime_error("Rays should not have negative bounces");
-        }
     }
 
     // return: whether the ray can bounce anymore times.
     bool can_bounce() const {
-        return bounces_remaining != 0;
+        return bounces_remaining > 0;
+    }
+
+    // return: the direction of the ray with a length of one.
+    vec3 normalized_dir() const {
+        return glm::normalize(this->dir);
+    }
+
+    // return: the point the given distance along the ray, in multiples of its
+    //         direction.
+    vec3 at(float t) const {
+        return this->start + t * this->dir;
     }
 
     // return: this ray, where the start position is offset by a small amount.
-    Ray offset(vec4 offset_dir, float offset_scalar) const {
-        return Ray(this->start + offset_scalar * offset_dir, this->dir, this->bounces_remaining);
+    Ray offset(vec3 offset_dir, float offset_scalar) const {
+        Ray offset = *this;
+        offset.start += offset_scalar * offset_dir;
+        return offset;
     }
 };
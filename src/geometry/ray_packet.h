@@ -0,0 +1,273 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include "ray.h"
+#include "bounding_cube4.h"
+#include "primitives/triangle.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+using glm::vec3;
+
+// The number of rays along each side of a packet, i.e. packets cover squares
+// of pixels.
+const int packet_width = 8;
+// The maximum number of rays in a packet.
+const int packet_size = packet_width * packet_width;
+// Rays are intersected in chunks of this many rays, one per SIMD lane.
+const int packet_chunk_size = 8;
+
+// A group of rays which start at the same position, e.g. primary rays for
+// neighbouring pixels. The directions are stored as a structure of arrays, so
+// a chunk of rays can be tested against a box or triangle at once. The range
+// of directions bounds the frustum containing all the rays, which is used to
+// cull nodes for the whole packet at once.
+struct RayPacket {
+    // The rays in the packet.
+    const Ray *rays;
+    const int num_rays;
+    // The start position shared by the rays.
+    float start[3];
+    // The direction and inverse direction, as in BoxTestRay, of each ray
+    // indexed by [axis][ray]. Lanes beyond num_rays are copies of the first ray.
+    float dir[3][packet_size] __attribute__((aligned(32)));
+    float inv_dir[3][packet_size] __attribute__((aligned(32)));
+    // The range of inverse directions on each axis, and whether the inverse
+    // directions on the axis all have the same sign. The range is only used
+    // if they do.
+    float min_inv_dir[3], max_inv_dir[3];
+    bool same_sign[3];
+
+    // param rays: up to packet_size rays, which must all start at the same
+    //             position.
+    RayPacket(const Ray *rays, int num_rays): rays(rays), num_rays(num_rays) {
+        for (int axis=0; axis<3; axis++) {
+            start[axis] = rays[0].start[axis];
+        }
+
+        for (int r=0; r<packet_size; r++) {
+            const Ray &ray = rays[r < num_rays ? r : 0];
+            const BoxTestRay box_ray = BoxTestRay(ray);
+
+            for (int axis=0; axis<3; axis++) {
+                dir[axis][r] = ray.dir[axis];
+                inv_dir[axis][r] = box_ray.inv_dir[axis];
+            }
+        }
+
+        for (int axis=0; axis<3; axis++) {
+            min_inv_dir[axis] = *std::min_element(inv_dir[axis], inv_dir[axis] + num_rays);
+            max_inv_dir[axis] = *std::max_element(inv_dir[axis], inv_dir[axis] + num_rays);
+            same_sign[axis] = min_inv_dir[axis] > 0.0f || max_inv_dir[axis] < 0.0f;
+        }
+    }
+
+    // param t_max: the end of the interval to test, e.g. the furthest closest
+    //              intersection of the rays.
+    // param t_enter: set to a lower bound on the distance at which any ray
+    //                enters each box.
+    // return: a bitmask with bit i set if any ray may intersect box i within
+    //         the interval.
+    int intersect_boxes(const BoundingCube4 &bounds, float t_max, float t_enter[4]) const {
+        // Each distance is the offset to a face multiplied by an inverse
+        // direction. The inverse directions of the rays lie within a range,
+        // so multiplying by the ends of the range bounds the distances of
+        // every ray. As rounding is monotonic, this holds for the distances
+        // each ray would compute on its own, so boxes are only culled if no
+        // ray would intersect them. Axes along which the directions change
+        // sign are not used to cull.
+#if defined(__SSE__)
+        __m128 enter = _mm_setzero_ps();
+        __m128 exit = _mm_set1_ps(t_max);
+
+        for (int axis=0; axis<3; axis++) {
+            if (!same_sign[axis]) {
+                continue;
+            }
+
+            const __m128 s = _mm_set1_ps(start[axis]);
+            const __m128 lo = _mm_set1_ps(min_inv_dir[axis]);
+            const __m128 hi = _mm_set1_ps(max_inv_dir[axis]);
+
+            const __m128 a = _mm_sub_ps(_mm_load_ps(bounds.min[axis]), s);
+            const __m128 b = _mm_sub_ps(_mm_load_ps(bounds.max[axis]), s);
+            const __m128 a_lo = _mm_mul_ps(a, lo), a_hi = _mm_mul_ps(a, hi);
+            const __m128 b_lo = _mm_mul_ps(b, lo), b_hi = _mm_mul_ps(b, hi);
+
+            enter = _mm_max_ps(enter, _mm_min_ps(_mm_min_ps(a_lo, a_hi), _mm_min_ps(b_lo, b_hi)));
+            exit = _mm_min_ps(exit, _mm_max_ps(_mm_max_ps(a_lo, a_hi), _mm_max_ps(b_lo, b_hi)));
+        }
+
+        _mm_storeu_ps(t_enter, enter);
+        return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+#else
+        int mask = 0;
+        for (int lane=0; lane<4; lane++) {
+            float enter = 0.0f, exit = t_max;
+
+            for (int axis=0; axis<3; axis++) {
+                if (!same_sign[axis]) {
+                    continue;
+                }
+
+                const float a = bounds.min[axis][lane] - start[axis];
+                const float b = bounds.max[axis][lane] - start[axis];
+                const float a_lo = a * min_inv_dir[axis], a_hi = a * max_inv_dir[axis];
+                const float b_lo = b * min_inv_dir[axis], b_hi = b * max_inv_dir[axis];
+
+                enter = std::max(enter, std::min(std::min(a_lo, a_hi), std::min(b_lo, b_hi)));
+                exit = std::min(exit, std::max(std::max(a_lo, a_hi), std::max(b_lo, b_hi)));
+            }
+
+            t_enter[lane] = enter;
+            mask |= (enter <= exit) << lane;
+        }
+        return mask;
+#endif
+    }
+
+    // param lane: the box, in bounds, to test.
+    // param t_max: the end of the interval to test for each ray, which is
+    //              multiplied by slack.
+    // param ray_mask: the rays to test.
+    // return: a mask of the rays which intersect the box, as tested by
+    //         BoundingCube4::intersect_ray.
+    uint64_t intersect_box_rays(const BoundingCube4 &bounds, int lane, const float *t_max, float slack, uint64_t ray_mask) const {
+        uint64_t hit_mask = 0;
+
+        for (int first=0; first<packet_size; first+=packet_chunk_size) {
+            if (((ray_mask >> first) & 0xff) == 0) {
+                continue;
+            }
+
+#if defined(__AVX__)
+            __m256 enter = _mm256_setzero_ps();
+            __m256 exit = _mm256_mul_ps(_mm256_loadu_ps(&t_max[first]), _mm256_set1_ps(slack));
+
+            for (int axis=0; axis<3; axis++) {
+                const __m256 s = _mm256_set1_ps(start[axis]);
+                const __m256 inv = _mm256_load_ps(&inv_dir[axis][first]);
+
+                const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.min[axis][lane]), s), inv);
+                const __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.max[axis][lane]), s), inv);
+
+                enter = _mm256_max_ps(enter, _mm256_min_ps(t1, t2));
+                exit = _mm256_min_ps(exit, _mm256_max_ps(t1, t2));
+            }
+
+            const uint64_t chunk_mask = _mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+#else
+            uint64_t chunk_mask = 0;
+            for (int i=0; i<packet_chunk_size; i++) {
+                float enter = 0.0f, exit = t_max[first + i] * slack;
+
+                for (int axis=0; axis<3; axis++) {
+                    float t1 = (bounds.min[axis][lane] - start[axis]) * inv_dir[axis][first + i];
+                    float t2 = (bounds.max[axis][lane] - start[axis]) * inv_dir[axis][first + i];
+
+                    enter = std::max(enter, std::min(t1, t2));
+                    exit = std::min(exit, std::max(t1, t2));
+                }
+
+                chunk_mask |= (uint64_t)(enter <= exit) << i;
+            }
+#endif
+            hit_mask |= chunk_mask << first;
+        }
+
+        return hit_mask & ray_mask;
+    }
+
+    // param first: the first ray in the chunk to test, a multiple of
+    //              packet_chunk_size.
+    // param v0, e1, e2, e1_cross_e2: the triangle, as passed to
+    //                                Triangle::solve_intersection.
+    // param t_max: the end of the interval to test for each ray.
+    // param tuv: set to the intersection as [t u v] for each ray in the chunk
+    //            which hits the triangle.
+    // return: a mask, for the rays in the chunk, of the rays which hit the
+    //         triangle within their interval. Each ray gets the same result
+    //         as Triangle::solve_intersection.
+    int intersect_triangle(int first, vec3 v0, vec3 e1, vec3 e2, vec3 e1_cross_e2, const float *t_max, vec3 tuv[packet_chunk_size]) const {
+#if defined(__AVX__)
+        // The rays share a start, so b and t are the same for every ray.
+        const vec3 b = vec3(start[0], start[1], start[2]) - v0;
+        const float t_shared = -dot(b, e1_cross_e2);
+
+        const __m256 dx = _mm256_load_ps(&dir[0][first]);
+        const __m256 dy = _mm256_load_ps(&dir[1][first]);
+        const __m256 dz = _mm256_load_ps(&dir[2][first]);
+        const __m256 bx = _mm256_set1_ps(b.x), by = _mm256_set1_ps(b.y), bz = _mm256_set1_ps(b.z);
+
+        // q = cross(dir, b), computed in the same order as glm.
+        const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(dy, bz), _mm256_mul_ps(by, dz));
+        const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(dz, bx), _mm256_mul_ps(bz, dx));
+        const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(dx, by), _mm256_mul_ps(bx, dy));
+
+        auto dot8 = [](vec3 v, __m256 x, __m256 y, __m256 z) {
+            return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(v.x), x), _mm256_mul_ps(_mm256_set1_ps(v.y), y)), _mm256_mul_ps(_mm256_set1_ps(v.z), z));
+        };
+
+        __m256 det = dot8(e1_cross_e2, dx, dy, dz);
+        __m256 t = _mm256_set1_ps(t_shared);
+        __m256 u = dot8(e2, qx, qy, qz);
+        __m256 v = _mm256_xor_ps(dot8(e1, qx, qy, qz), _mm256_set1_ps(-0.0f));
+
+        // Make det positive by flipping the signs of every lane where it is
+        // negative.
+        const __m256 sign = _mm256_and_ps(det, _mm256_set1_ps(-0.0f));
+        det = _mm256_xor_ps(det, sign);
+        t = _mm256_xor_ps(t, sign);
+        u = _mm256_xor_ps(u, sign);
+        v = _mm256_xor_ps(v, sign);
+
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 valid = _mm256_cmp_ps(det, zero, _CMP_GT_OQ);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(zero, t, _CMP_LT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(zero, u, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(zero, v, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), det, _CMP_LE_OQ));
+
+        int mask = _mm256_movemask_ps(valid);
+        if (mask == 0) {
+            return 0;
+        }
+
+        const __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+        t = _mm256_mul_ps(t, inv_det);
+        u = _mm256_mul_ps(u, inv_det);
+        v = _mm256_mul_ps(v, inv_det);
+        mask &= _mm256_movemask_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+        mask &= _mm256_movemask_ps(_mm256_cmp_ps(t, _mm256_loadu_ps(&t_max[first]), _CMP_LE_OQ));
+
+        float ts[packet_chunk_size], us[packet_chunk_size], vs[packet_chunk_size];
+        _mm256_storeu_ps(ts, t);
+        _mm256_storeu_ps(us, u);
+        _mm256_storeu_ps(vs, v);
+        for (int i=0; i<packet_chunk_size; i++) {
+            tuv[i] = vec3(ts[i], us[i], vs[i]);
+        }
+        return mask;
+#else
+        int mask = 0;
+        for (int i=0; i<packet_chunk_size && first + i < num_rays; i++) {
+            optional<vec3> hit = Triangle::solve_intersection(rays[first + i], v0, e1, e2, e1_cross_e2);
+
+            if (hit.has_value() && hit->x > 0.0f && hit->x <= t_max[first + i]) {
+                tuv[i] = *hit;
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+#endif
+    }
+};
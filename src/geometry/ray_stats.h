@@ -0,0 +1,215 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+
+using std::vector;
+
+// Compile with -DRAY_STATS=1 to count the work done to render each frame,
+// e.g. rays of each type, box and primitive tests, and volume march steps.
+// Otherwise COUNT_RAY_STAT and COUNT_BOUNCE expand to nothing, so neither
+// the counting nor the arguments cost anything. Only the total number of
+// rays traced is always counted, as it costs one increment per ray.
+#ifndef RAY_STATS
+#define RAY_STATS 0
+#endif
+
+enum RayStat {
+    // Rays by the reason they were traced.
+    stat_primary_rays, stat_reflection_rays, stat_refraction_rays, stat_shadow_rays, stat_volume_rays,
+    // Tests of a ray against a box in the hierarchies, and against each
+    // type of primitive.
+    stat_box_tests, stat_triangle_tests, stat_sphere_tests, stat_disc_tests, stat_other_tests,
+    // Steps taken marching rays through volumes.
+    stat_march_steps,
+    num_ray_stats
+};
+
+// Rays are counted by the number of bounces they have left, up to this many.
+const int max_stat_bounces = 16;
+
+#if RAY_STATS
+#define COUNT_RAY_STAT(stat, n) RayStats::add(stat, n)
+#define COUNT_BOUNCE(bounces_remaining) RayStats::add_bounce(bounces_remaining)
+#else
+#define COUNT_RAY_STAT(stat, n)
+#define COUNT_BOUNCE(bounces_remaining)
+#endif
+
+// The work counted by RayStats, e.g. over one frame.
+struct FrameStats {
+    // The number of rays traced through the scene, of any type.
+    long rays = 0;
+    long counts[num_ray_stats] = {};
+    // The number of primary and bounced rays with each number of bounces
+    // remaining.
+    long bounces[max_stat_bounces] = {};
+
+    // return: the name of the statistic, as used in the report and JSON.
+    static const char *name(int stat) {
+        static const char *names[num_ray_stats] = {
+            "primary_rays", "reflection_rays", "refraction_rays", "shadow_rays", "volume_rays",
+            "box_tests", "triangle_tests", "sphere_tests", "disc_tests", "other_tests",
+            "march_steps"
+        };
+        return names[stat];
+    }
+
+    // return: the bounce depth, i.e. the number of bounces since leaving the
+    //         camera, of rays counted with the given number of bounces
+    //         remaining. Primary rays have the most bounces remaining, so
+    //         give the depth of the others.
+    int depth(int bounces_remaining) const {
+        int max_remaining = 0;
+        for (int b=0; b<max_stat_bounces; b++) {
+            if (this->bounces[b] > 0) {
+                max_remaining = b;
+            }
+        }
+        return max_remaining - bounces_remaining;
+    }
+
+    // effect: writes a table of the counts, and the number of rays at each
+    //         bounce depth.
+    void print(std::ostream &out) const {
+        out << std::setw(16) << "rays" << std::setw(14) << this->rays << std::endl;
+        if (!RAY_STATS) {
+            return;
+        }
+
+        for (int s=0; s<num_ray_stats; s++) {
+            out << std::setw(16) << FrameStats::name(s) << std::setw(14) << this->counts[s] << std::endl;
+        }
+        for (int b=max_stat_bounces-1; b>=0; b--) {
+            if (this->bounces[b] > 0) {
+                out << std::setw(13) << "depth " << std::setw(2) << this->depth(b) << std::setw(14) << this->bounces[b] << std::endl;
+            }
+        }
+    }
+
+    // effect: writes the counts as a JSON object on one line, with the
+    //         number of rays at each bounce depth, from zero, in an array.
+    void write_json(std::ostream &out) const {
+        out << "{\"rays\": " << this->rays;
+        if (RAY_STATS) {
+            for (int s=0; s<num_ray_stats; s++) {
+                out << ", \"" << FrameStats::name(s) << "\": " << this->counts[s];
+            }
+
+            out << ", \"rays_by_depth\": [";
+            bool first = true;
+            for (int b=max_stat_bounces-1; b>=0; b--) {
+                if (this->bounces[b] > 0 || !first) {
+                    out << (first ? "" : ", ") << this->bounces[b];
+                    first = false;
+                }
+            }
+            out << "]";
+        }
+        out << "}";
+    }
+};
+
+// Counts the work done by each thread, e.g. to measure rays per second.
+// Each thread increments its own counts, on their own cache lines, so
+// threads do not contend. The counts are only summed when asked for, which
+// must not be while rays are being traced, e.g. between frames.
+class RayStats {
+private:
+    struct alignas(64) Counts {
+        FrameStats stats;
+    };
+
+public:
+    // effect: counts rays traced through the scene by the calling thread.
+    static void count_rays(long num_rays) {
+        RayStats::local().rays += num_rays;
+    }
+
+    // effect: adds to a statistic of the calling thread. Use COUNT_RAY_STAT,
+    //         so the count is only made when RAY_STATS is enabled.
+    static void add(RayStat stat, long n) {
+        RayStats::local().counts[stat] += n;
+    }
+
+    // effect: counts a primary or bounced ray with the number of bounces it
+    //         has remaining. Use COUNT_BOUNCE, as for add.
+    static void add_bounce(int bounces_remaining) {
+        RayStats::local().bounces[std::min(std::max(bounces_remaining, 0), max_stat_bounces - 1)]++;
+    }
+
+    // return: the work done by the calling thread since the last reset,
+    //         e.g. to find the work done for a single pixel by the
+    //         difference before and after rendering it.
+    static const FrameStats &thread_total() {
+        return RayStats::local();
+    }
+
+    // return: the work done by all threads since the last reset.
+    static FrameStats total() {
+        std::lock_guard<std::mutex> lock(RayStats::mutex());
+        FrameStats total;
+        for (const Counts *counts: RayStats::all_counts()) {
+            RayStats::add_to(total, counts->stats);
+        }
+        return total;
+    }
+
+    // effect: sets the counts of every thread to zero, e.g. at the start of
+    //         a frame.
+    static void reset() {
+        std::lock_guard<std::mutex> lock(RayStats::mutex());
+        for (Counts *counts: RayStats::all_counts()) {
+            counts->stats = FrameStats();
+        }
+    }
+
+private:
+    static void add_to(FrameStats &total, const FrameStats &stats) {
+        total.rays += stats.rays;
+        for (int s=0; s<num_ray_stats; s++) {
+            total.counts[s] += stats.counts[s];
+        }
+        for (int b=0; b<max_stat_bounces; b++) {
+            total.bounces[b] += stats.bounces[b];
+        }
+    }
+
+    // return: the counts of the calling thread, which are made the first
+    //         time the thread counts anything. A plain pointer is kept, as
+    //         in ScratchVector, rather than the counts themselves, so there
+    //         is no thread_local to construct, which would be checked for
+    //         on every count.
+    static FrameStats &local() {
+        static thread_local FrameStats *stats = nullptr;
+        if (stats == nullptr) {
+            stats = RayStats::add_thread();
+        }
+        return *stats;
+    }
+
+    // return: new counts for the calling thread. They are never freed, so
+    //         the work of threads which have finished stays in the total.
+    //         OpenMP reuses its threads, so only a few are ever made.
+    static FrameStats *add_thread() {
+        std::lock_guard<std::mutex> lock(RayStats::mutex());
+        Counts *counts = new Counts();
+        RayStats::all_counts().push_back(counts);
+        return &counts->stats;
+    }
+
+    // The counts of every thread which has counted anything. A function
+    // static is used so the counts need no definition outside the header.
+    static vector<Counts*> &all_counts() {
+        static vector<Counts*> all;
+        return all;
+    }
+
+    static std::mutex &mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+};
@@ -5,9 +5,19 @@
 #include <vector>
 #include <functional>
 #include <optional>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
 #include "intersection.h"
 #include "object.h"
+#include "compiled_object.h"
 #include "projection.h"
+#include "bvh.h"
+#include "dynamic_bvh.h"
+#include "ray_packet.h"
+#include "arena.h"
+#include "scratch.h"
+#include "ray_stats.h"
 #include "../lights/light.h"
 
 using glm::length;
@@ -15,25 +25,70 @@ using std::vector;
 using std::function;
 using std::optional;
 using std::nullopt;
+using std::unordered_map;
+using std::pair;
 
 // Contains all the geometry, lights, etc for a scene.
 //
+// Objects can be added, removed, and moved between frames. Each object's
+// hierarchy and compiled primitives are in the object's own coordinates, so
+// only the top level of the acceleration structure is updated, and only
+// where the object is. For the same reason, instances of an object share
+// its hierarchy and compiled primitives, which are only compiled once.
+//
 // WARNING: when the scene is destroyed the objects, and lights, pointed to by
-// the scene will also be destroyed.
+// the scene will also be destroyed. Therefore scenes cannot be copied.
 class Scene {
 public:
     // The number of objects in the scene.
-    const int num_objects;
-    // An array containing the objects in the scene.
+    int num_objects;
+    // An array containing the objects in the scene. Objects may be reordered
+    // when one is removed.
     const Object **objects;
     // An array of the lights in the scene.
     const vector<Light*> lights;
 
-    Scene(const int num_objects, const Object **objects, const vector<Light*> lights):
-        num_objects(num_objects), objects(objects), lights(lights)
+private:
+    // The number of objects there is space for in objects.
+    int objects_capacity;
+    // The index of each object in objects.
+    unordered_map<const Object*, int> object_indices;
+    // Hierarchy over the bounding cubes of the objects, i.e. the top level of
+    // the acceleration structure. Each object holds the bottom level
+    // hierarchy over its own primitives.
+    DynamicBVH top_level;
+    // The primitives of each object, compiled into arrays for intersecting
+    // with rays.
+    vector<const CompiledObject*> compiled_objects;
+    // The compiled primitives of each object which is not an instance, and
+    // the number of objects in the scene sharing them. Compiled primitives
+    // are destroyed once no object uses them.
+    unordered_map<const Object*, pair<CompiledObject*, int>> compiled_geometry;
+    // Owns the primitives, shaders, etc, of scenes made by a SceneBuilder,
+    // or nullptr.
+    Arena *arena;
+
+public:
+    // param arena: the arena owning parts of the scene, which the scene
+    //              takes ownership of and destroys after the objects.
+    Scene(const int num_objects, const Object **objects, const vector<Light*> lights, Arena *arena = nullptr):
+        num_objects(num_objects),
+        objects(objects),
+        lights(lights),
+        objects_capacity(num_objects),
+        object_indices(Scene::make_object_indices(num_objects, objects)),
+        top_level(Scene::object_bounds(num_objects, objects)),
+        arena(arena)
     {
+        this->compiled_objects.reserve(num_objects);
+        for (int j=0; j<num_objects; j++) {
+            this->compiled_objects.push_back(this->compile(objects[j]));
+        }
     }
 
+    Scene(const Scene&) = delete;
+    Scene &operator=(const Scene&) = delete;
+
     ~Scene() {
         for (size_t i=0; i<lights.size(); i++) {
             delete lights[i];
@@ -43,72 +98,87 @@ public:
             delete objects[i];
         }
         delete[] objects;
+
+        for (auto &compiled: this->compiled_geometry) {
+            delete compiled.second.first;
+        }
+
+        delete this->arena;
     }
 
     // param ray:              A ray, in scene coordinates, check intersection with.
     // param is_excluded_prim: Returns whether to discount intersections with
-    //                         the given primtive.
+    //                         the given primtive, hit as part of the given
+    //                         object. Taken as a template, rather than a
+    //                         std::function, so it is not copied to the heap
+    //                         on each call.
     // return:                 The closest intersection to the start of the ray,
     //                         or nothing if no intersection was found.
-    optional<Intersection> closest_intersection(const Ray &ray, const function<bool(const Primitive*)> is_excluded_prim) const {
-        float closest_distance = std::numeric_limits<float>::max();
+    template<typename F, typename = std::enable_if_t<std::is_invocable_r_v<bool, F, const Primitive*, const Object*>>>
+    optional<Intersection> closest_intersection(const Ray &ray, F is_excluded_prim) const {
+        RayStats::count_rays(1);
+
+        // Distances are in multiples of the ray's direction.
+        float closest_t = ray.t_max;
         int closest_obj_idx = -1;
         int closest_primitive_idx = -1;
-        // The intersection point in the scene's coordinate system.
-        vec4 intersection_pos;
+        Hit closest_hit;
 
-        for (int j=0; j<this->num_objects; j++) {
-            const Object *object = this->objects[j];
-
-            // Ignore objects for which the ray does not intersect the bounding
-            // box of the object.
-            if (!object->bounding_cube.does_intersect_ray(ray)) {
-                continue;
-            }
+        auto intersect_obj = [&](int j) {
+            // Primitives further than the closest hit so far are not
+            // reported.
+            auto visit_hit = [&](int i, const Hit &hit) {
+                // Ties are broken by the order of the primitives in the scene,
+                // so the result does not depend on the order of traversal.
+                bool is_tie = hit.t == closest_t
+                           && (j < closest_obj_idx || (j == closest_obj_idx && i < closest_primitive_idx));
 
-            Primitive **primitives = object->primitives;
-
-            for (int i=0; i<object->num_prims; i++) {
-                if (is_excluded_prim(primitives[i])) {
-                    continue;
+                if (!(hit.t < closest_t || is_tie) || hit.t < ray.t_min) {
+                    return;
                 }
 
-                // The intersection in the scene coordinate system.
-                optional<vec4> intersection = primitives[i]->intersection(ray);
-
-                if (!intersection.has_value()) {
-                    continue;
+                // Checked after intersecting, as calling is_excluded_prim
+                // costs more than rejecting most primitives.
+                if (is_excluded_prim(this->objects[j]->primitives[i], this->objects[j])) {
+                    return;
                 }
 
-                // The distance from the point in scene coordinates to the ray in
-                // scene coordinates.
-                float dist = length(*intersection - ray.start);
+                closest_t = hit.t;
+                closest_obj_idx = j;
+                closest_primitive_idx = i;
+                closest_hit = hit;
+            };
 
-                if (dist < closest_distance) {
-                    closest_distance = dist;
-                    closest_obj_idx = j;
-                    closest_primitive_idx = i;
-                    intersection_pos = *intersection;
-                }
+            // Moved objects are intersected in their own coordinates.
+            optional<Ray> local_ray;
+            if (this->objects[j]->has_transform()) {
+                local_ray.emplace(this->objects[j]->ray_to_object(ray));
             }
-        }
+
+            this->compiled_objects[j]->intersect(local_ray.has_value() ? *local_ray : ray, closest_t, visit_hit);
+        };
+
+        this->top_level.traverse(ray, closest_t, intersect_obj);
 
         if (closest_primitive_idx == -1) {
             return nullopt;
         }
 
-        Primitive *prim = this->objects[closest_obj_idx]->primitives[closest_primitive_idx];
-        return Intersection(intersection_pos, prim);
+        const Object *obj = this->objects[closest_obj_idx];
+        return Intersection(ray, closest_hit, obj->primitives[closest_primitive_idx], obj);
     }
 
     // param ray:           A ray, in scene coordinates, check intersection with.
     // param excluded_prim: The primitive to discount intersections with.
     //                      This can be useful to avoid self-intersection.
+    // param excluded_obj:  The object the excluded primitive is part of. The
+    //                      primitive is still hit as part of other instances
+    //                      of the object.
     // return:              The closest intersection to the start of the ray,
     //                      or null if no intersection was found.
-    optional<Intersection> closest_intersection(const Ray &ray, const Primitive *excluded_prim = nullptr) const {
-        auto is_excluded_prim = [&](const Primitive *prim) {
-            return prim == excluded_prim;
+    optional<Intersection> closest_intersection(const Ray &ray, const Primitive *excluded_prim = nullptr, const Object *excluded_obj = nullptr) const {
+        auto is_excluded_prim = [&](const Primitive *prim, const Object *obj) {
+            return prim == excluded_prim && obj == excluded_obj;
         };
         return this->closest_intersection(ray, is_excluded_prim);
     }
@@ -118,36 +188,245 @@ public:
     // return:                 The closest intersection to the start of the ray,
     //                         or null if no intersection was found.
     optional<Intersection> closest_intersection_excluding_obj(const Ray &ray, const Object *excluded_obj) const {
-        auto is_excluded_prim = [&](const Primitive *prim) {
-            return prim->parent_obj == excluded_obj;
+        auto is_excluded_prim = [&](const Primitive*, const Object *obj) {
+            return obj == excluded_obj;
         };
         return this->closest_intersection(ray, is_excluded_prim);
     }
 
+    // param packet: rays which start at the same position, e.g. primary rays
+    //               for neighbouring pixels.
+    // param intersections: set to the closest intersection along each ray in
+    //                      the packet, as returned by closest_intersection.
+    //                      Must have space for every ray in the packet.
+    // effect: traces the rays through the scene together, which is faster
+    //         than tracing them one at a time when they are coherent.
+    void closest_intersections(const RayPacket &packet, optional<Intersection> *intersections) const {
+        RayStats::count_rays(packet.num_rays);
+
+        // The closest hit so far for each ray, as in closest_intersection.
+        // Lanes beyond the rays in the packet are given a negative distance
+        // so they never affect the traversal.
+        float closest_t[packet_size];
+        int closest_obj_idx[packet_size];
+        int closest_primitive_idx[packet_size];
+        Hit closest_hits[packet_size];
+        uint64_t ray_mask = 0;
+
+        for (int r=0; r<packet_size; r++) {
+            closest_t[r] = r < packet.num_rays ? packet.rays[r].t_max : -1.0f;
+            closest_obj_idx[r] = -1;
+            closest_primitive_idx[r] = -1;
+            if (r < packet.num_rays) {
+                ray_mask |= (uint64_t)1 << r;
+            }
+        }
+
+        auto visit_leaf = [&](int first, int count, uint64_t rays) {
+            for (int k=first; k<first + count; k++) {
+                const int j = this->top_level.item_indices[k];
+
+                auto visit_hit = [&](int r, int i, const Hit &hit) {
+                    bool is_tie = hit.t == closest_t[r]
+                               && (j < closest_obj_idx[r] || (j == closest_obj_idx[r] && i < closest_primitive_idx[r]));
+
+                    if ((hit.t < closest_t[r] || is_tie) && hit.t >= packet.rays[r].t_min) {
+                        closest_t[r] = hit.t;
+                        closest_obj_idx[r] = j;
+                        closest_primitive_idx[r] = i;
+                        closest_hits[r] = hit;
+                    }
+                };
+
+                const Object *obj = this->objects[j];
+                if (!obj->has_transform()) {
+                    this->compiled_objects[j]->intersect_packet(packet, closest_t, rays, visit_hit);
+                    continue;
+                }
+
+                // The rays still share a start once transformed, so can be
+                // intersected as a packet in the object's coordinates.
+                ScratchVector<Ray> local_rays;
+                for (int r=0; r<packet.num_rays; r++) {
+                    local_rays->push_back(obj->ray_to_object(packet.rays[r]));
+                }
+
+                const RayPacket local_packet = RayPacket(local_rays->data(), local_rays->size());
+                this->compiled_objects[j]->intersect_packet(local_packet, closest_t, rays, visit_hit);
+            }
+        };
+
+        this->top_level.traverse_packet(packet, closest_t, ray_mask, visit_leaf);
+
+        for (int r=0; r<packet.num_rays; r++) {
+            if (closest_primitive_idx[r] == -1) {
+                intersections[r].reset();
+            } else {
+                const Object *obj = this->objects[closest_obj_idx[r]];
+                intersections[r].emplace(packet.rays[r], closest_hits[r], obj->primitives[closest_primitive_idx[r]], obj);
+            }
+        }
+    }
 
     // param ray:           A ray, in scene coordinates, check intersection with.
+    //                      Only intersections within the ray's interval are
+    //                      visited, e.g. not those behind a light.
     // param excluded_prim: The primitive to discount intersections with.
     //                      This can be useful to avoid self-intersection.
-    // return:              All intersections along a ray.
-    vector<Intersection> all_intersections(const Ray &ray, const Primitive *excluded_prim = nullptr) const {
-        vector<Intersection> intersections;
+    // param excluded_obj:  The object the excluded primitive is part of, as
+    //                      in closest_intersection.
+    // param visit:         Called with each intersection along the ray, in no
+    //                      particular order. Returns whether to continue
+    //                      searching, therefore the search can stop as soon
+    //                      as the answer is known, e.g. an opaque occluder is
+    //                      found.
+    template<typename F>
+    void for_each_intersection(const Ray &ray, const Primitive *excluded_prim, const Object *excluded_obj, F visit) const {
+        RayStats::count_rays(1);
 
-        for (int j=0; j<this->num_objects; j++) {
-            Primitive **primitives = this->objects[j]->primitives;
+        // Shrunk below zero to stop the search early.
+        float search_t = ray.t_max;
 
-            for (int i=0; i<this->objects[j]->num_prims; i++) {
-                if (primitives[i] == excluded_prim) {
-                    continue;
-                }
+        auto intersect_obj = [&](int j) {
+            const Object *obj = this->objects[j];
+            Primitive **primitives = obj->primitives;
 
-                optional<vec4> intersection_pos = primitives[i]->intersection(ray);
+            auto visit_hit = [&](int i, const Hit &hit) {
+                if ((primitives[i] == excluded_prim && obj == excluded_obj) || hit.t >= ray.t_max || hit.t < ray.t_min) {
+                    return;
+                }
 
-                if (intersection_pos.has_value()) {
-                    intersections.push_back(Intersection(*intersection_pos, primitives[i]));
+                if (!visit(Intersection(ray, hit, primitives[i], obj))) {
+                    search_t = -1.0f;
                 }
+            };
+
+            optional<Ray> local_ray;
+            if (obj->has_transform()) {
+                local_ray.emplace(obj->ray_to_object(ray));
             }
+
+            this->compiled_objects[j]->intersect(local_ray.has_value() ? *local_ray : ray, search_t, visit_hit);
+        };
+
+        this->top_level.traverse(ray, search_t, intersect_obj);
+    }
+
+    // param ray:           A ray, in scene coordinates, check intersection with.
+    // param intersections: The buffer to add all intersections along the ray
+    //                      to, e.g. a ScratchVector.
+    // param excluded_prim: The primitive to discount intersections with.
+    //                      This can be useful to avoid self-intersection.
+    // param excluded_obj:  The object the excluded primitive is part of.
+    void all_intersections(const Ray &ray, vector<Intersection> &intersections, const Primitive *excluded_prim = nullptr, const Object *excluded_obj = nullptr) const {
+        auto add_intersection = [&](const Intersection &intersection) {
+            intersections.push_back(intersection);
+            return true;
+        };
+
+        this->for_each_intersection(ray, excluded_prim, excluded_obj, add_intersection);
+    }
+
+    // effect: adds the object to the scene, which takes ownership of it.
+    //         Only the leaf of the top level hierarchy the object is added
+    //         to is rebuilt.
+    void add_object(const Object *object) {
+        if (this->num_objects == this->objects_capacity) {
+            this->objects_capacity = std::max(2 * this->objects_capacity, 1);
+
+            const Object **objects = new const Object*[this->objects_capacity];
+            std::copy(this->objects, this->objects + this->num_objects, objects);
+            delete[] this->objects;
+            this->objects = objects;
+        }
+
+        this->object_indices[object] = this->num_objects;
+        this->objects[this->num_objects++] = object;
+        this->compiled_objects.push_back(this->compile(object));
+        this->top_level.add_item(object->world_bounding_cube());
+    }
+
+    // effect: removes the object from the scene, and gives ownership of it
+    //         back to the caller. The last object in the scene takes the
+    //         index of the removed object.
+    void remove_object(const Object *object) {
+        const int j = this->object_indices.at(object);
+        const int last = this->num_objects - 1;
+
+        this->top_level.remove_item(j);
+        this->object_indices.erase(object);
+        this->release_compiled(object);
+
+        if (j != last) {
+            this->objects[j] = this->objects[last];
+            this->object_indices[this->objects[j]] = j;
+            this->compiled_objects[j] = this->compiled_objects[last];
+        }
+
+        this->compiled_objects.pop_back();
+        this->num_objects--;
+    }
+
+    // param object: an object in the scene.
+    // param transform: the transform from the coordinates the object was
+    //                  created in to the scene's, replacing any previous
+    //                  transform.
+    // effect: moves the object. Its primitives are unchanged, so only the
+    //         boxes above it in the top level hierarchy are refitted.
+    void transform_object(Object *object, const mat4 &transform) {
+        object->set_transform(transform);
+        this->top_level.move_item(this->object_indices.at(object), object->world_bounding_cube());
+    }
+
+    // effect: rebuilds the top level of the acceleration structure from the
+    //         current bounds of the objects, e.g. to improve its quality
+    //         after many objects have been moved.
+    void rebuild_top_level() {
+        this->top_level = DynamicBVH(Scene::object_bounds(this->num_objects, this->objects));
+    }
+
+private:
+    // return: a map from each object to its index.
+    static unordered_map<const Object*, int> make_object_indices(const int num_objects, const Object **objects) {
+        unordered_map<const Object*, int> indices;
+
+        for (int j=0; j<num_objects; j++) {
+            indices[objects[j]] = j;
+        }
+
+        return indices;
+    }
+
+    // return: the compiled primitives of the object, which are only
+    //         compiled if no other object in the scene shares them.
+    const CompiledObject *compile(const Object *object) {
+        pair<CompiledObject*, int> &compiled = this->compiled_geometry[&object->geometry()];
+        if (compiled.first == nullptr) {
+            compiled.first = new CompiledObject(&object->geometry());
+        }
+        compiled.second++;
+        return compiled.first;
+    }
+
+    // effect: stops the object from using its compiled primitives, which are
+    //         destroyed if no other object in the scene uses them.
+    void release_compiled(const Object *object) {
+        auto compiled = this->compiled_geometry.find(&object->geometry());
+        if (--compiled->second.second == 0) {
+            delete compiled->second.first;
+            this->compiled_geometry.erase(compiled);
+        }
+    }
+
+    // return: the bounding cubes of the objects, used to build the top level
+    //         of the acceleration structure.
+    static vector<BoundingCube> object_bounds(const int num_objects, const Object **objects) {
+        vector<BoundingCube> bounds;
+
+        for (int j=0; j<num_objects; j++) {
+            bounds.push_back(objects[j]->world_bounding_cube());
         }
 
-        return intersections;
+        return bounds;
     }
 };
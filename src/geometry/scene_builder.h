@@ -0,0 +1,207 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <typeinfo>
+#include <type_traits>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+#include "arena.h"
+#include "object.h"
+#include "scene.h"
+#include "primitives/primitive.h"
+#include "../lights/light.h"
+
+using std::vector;
+using std::string;
+using std::unordered_map;
+using glm::mat4;
+
+// Used to make a scene whose primitives, shaders, and textures are stored in
+// an arena, rather than allocated one at a time. Shaders and textures made
+// with the same arguments are only made once, and shared by everything using
+// them.
+//
+// WARNING: everything made by the builder is destroyed along with the scene
+// it builds, and the builder cannot be used after building the scene.
+class SceneBuilder {
+private:
+    Arena *arena;
+    // The shaders and textures which have been made, keyed by their type and
+    // the arguments they were made with.
+    unordered_map<string, void*> shared;
+    vector<const Object*> objects;
+    vector<Light*> lights;
+
+public:
+    SceneBuilder(): arena(new Arena()) {
+    }
+
+    SceneBuilder(const SceneBuilder&) = delete;
+    SceneBuilder &operator=(const SceneBuilder&) = delete;
+
+    // Only destroys what was made if the scene was never built.
+    ~SceneBuilder() {
+        for (const Object *object: this->objects) {
+            delete object;
+        }
+        for (Light *light: this->lights) {
+            delete light;
+        }
+        delete this->arena;
+    }
+
+    // return: a shader of type S made with the arguments, which is shared
+    //         with any other shader of type S made with equal arguments.
+    template<typename S, typename... Args>
+    const S *shader(Args&&... args) {
+        return this->make_shared<S>(std::forward<Args>(args)...);
+    }
+
+    // return: a texture of type T made with the arguments, which is shared as
+    //         with shaders. Textures which are different each time they are
+    //         made, e.g. Perlin, should be made with unique instead.
+    template<typename T, typename... Args>
+    T *texture(Args&&... args) {
+        return this->make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    // return: a new instance of T, e.g. a shader or texture, which is not
+    //         shared even if an equal one has already been made.
+    template<typename T, typename... Args>
+    T *unique(Args&&... args) {
+        return this->arena->make<T>(std::forward<Args>(args)...);
+    }
+
+    // return: a new primitive of type P made with the arguments. The
+    //         primitive is not part of the scene until added to an object.
+    template<typename P, typename... Args>
+    P *primitive(Args&&... args) {
+        return this->arena->make<P>(std::forward<Args>(args)...);
+    }
+
+    // effect: adds an object made up of the primitives, which must have been
+    //         made by the builder.
+    void add_object(const vector<Primitive*> &primitives) {
+        Primitive **prims = new Primitive*[primitives.size()];
+        std::copy(primitives.begin(), primitives.end(), prims);
+        this->objects.push_back(new Object(primitives.size(), prims, false));
+    }
+
+    // effect: adds an object, e.g. a mesh, which was not made by the builder.
+    //         The scene takes ownership of the object.
+    void add_object(Object *object) {
+        this->objects.push_back(object);
+    }
+
+    // return: an object made up of the primitives, which must have been made
+    //         by the builder, to place in the scene with add_instance. The
+    //         prototype itself is not added to the scene.
+    const Object *prototype(const vector<Primitive*> &primitives) {
+        Primitive **prims = new Primitive*[primitives.size()];
+        std::copy(primitives.begin(), primitives.end(), prims);
+        return this->arena->make<Object>(primitives.size(), prims, false);
+    }
+
+    // return: the object, e.g. a mesh, which was not made by the builder, to
+    //         place in the scene with add_instance. The scene takes ownership
+    //         of the object, but it is not added to the scene.
+    const Object *prototype(Object *object) {
+        this->arena->make<std::unique_ptr<Object>>(object);
+        return object;
+    }
+
+    // effect: adds an instance of the prototype, placed in the scene with the
+    //         transform from the prototype's coordinates. Instances share the
+    //         primitives of the prototype, so only add a transform each.
+    void add_instance(const Object *prototype, const mat4 &transform) {
+        this->objects.push_back(new Object(prototype, transform));
+    }
+
+    // effect: adds a light of type L made with the arguments.
+    template<typename L, typename... Args>
+    void light(Args&&... args) {
+        this->lights.push_back(new L(std::forward<Args>(args)...));
+    }
+
+    // return: a scene containing the objects and lights which were added,
+    //         which takes ownership of everything made by the builder.
+    Scene build() {
+        const int num_objects = this->objects.size();
+        const Object **objects = new const Object*[num_objects];
+        std::copy(this->objects.begin(), this->objects.end(), objects);
+
+        Arena *arena = this->arena;
+        const vector<Light*> lights = this->lights;
+
+        this->arena = nullptr;
+        this->objects.clear();
+        this->lights.clear();
+        this->shared.clear();
+
+        return Scene(num_objects, objects, lights, arena);
+    }
+
+private:
+    // Arguments which can be used to tell whether two shaders or textures
+    // are equal. Pointers are compared by address, so e.g. shaders made with
+    // the same shared texture are also shared.
+    template<typename A>
+    struct is_key {
+        using T = typename std::decay<A>::type;
+        static const bool value = std::is_arithmetic<T>::value
+                               || std::is_enum<T>::value
+                               || std::is_pointer<T>::value
+                               || std::is_same<T, glm::vec2>::value
+                               || std::is_same<T, glm::vec3>::value
+                               || std::is_same<T, glm::vec4>::value
+                               || std::is_same<T, string>::value;
+    };
+
+    // effect: appends a representation of the argument to the key. Strings,
+    //         including C strings, are compared by their contents.
+    template<typename A>
+    static void append_key(string &key, const A &arg) {
+        using T = typename std::decay<A>::type;
+        // The type is included so arguments of different types, which may
+        // select different constructors, are not confused.
+        key.append(typeid(T).name());
+        if constexpr (std::is_same<T, string>::value) {
+            SceneBuilder::append_string(key, arg.c_str());
+        } else if constexpr (std::is_same<T, char*>::value || std::is_same<T, const char*>::value) {
+            SceneBuilder::append_string(key, arg);
+        } else {
+            key.append(reinterpret_cast<const char*>(&arg), sizeof(T));
+        }
+    }
+
+    static void append_string(string &key, const char *str) {
+        const size_t length = std::strlen(str);
+        key.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        key.append(str, length);
+    }
+
+    // return: an instance of T made with the arguments, or the instance
+    //         already made with equal arguments. Instances made with
+    //         arguments which cannot be compared, e.g. functions, are never
+    //         shared.
+    template<typename T, typename... Args>
+    T *make_shared(Args&&... args) {
+        if constexpr ((is_key<Args>::value && ...)) {
+            string key = typeid(T).name();
+            (SceneBuilder::append_key(key, args), ...);
+
+            void *&instance = this->shared[key];
+            if (instance == nullptr) {
+                instance = this->arena->make<T>(std::forward<Args>(args)...);
+            }
+            return static_cast<T*>(instance);
+        } else {
+            return this->arena->make<T>(std::forward<Args>(args)...);
+        }
+    }
+};
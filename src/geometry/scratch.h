@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+
+// A vector borrowed from a pool kept by each thread, used for temporary
+// buffers in the render loop, e.g. shadow rays. The vector is empty when
+// borrowed, and returned to the pool, with its capacity kept, when the
+// ScratchVector is destroyed. Therefore once the pool has grown to the
+// largest buffers needed, no more memory is allocated.
+//
+// Buffers must be returned in the reverse order they were borrowed, which
+// holds as long as ScratchVectors are only created on the stack. Any number
+// can be borrowed at once, e.g. by shaders which recursively trace rays. The
+// pool lasts as long as its thread.
+template<typename T>
+class ScratchVector {
+private:
+    // The vectors of the calling thread, the first depth of which are
+    // borrowed. Plain pointers are used, rather than a vector, so the pool
+    // does not need to be constructed, which would be checked for on every
+    // access.
+    static thread_local vector<T> **pool;
+    static thread_local int pool_size;
+    static thread_local int depth;
+
+    vector<T> &vec;
+
+public:
+    ScratchVector(): vec(ScratchVector::borrow()) {
+    }
+
+    ScratchVector(const ScratchVector&) = delete;
+    ScratchVector &operator=(const ScratchVector&) = delete;
+
+    ~ScratchVector() {
+        ScratchVector::depth--;
+    }
+
+    vector<T> &operator*() {
+        return this->vec;
+    }
+
+    vector<T> *operator->() {
+        return &this->vec;
+    }
+
+private:
+    // return: the next unborrowed vector in the pool, which is cleared.
+    static vector<T> &borrow() {
+        if (ScratchVector::depth == ScratchVector::pool_size) {
+            ScratchVector::grow();
+        }
+
+        vector<T> &vec = *ScratchVector::pool[ScratchVector::depth++];
+        vec.clear();
+        return vec;
+    }
+
+    // effect: adds another vector to the pool.
+    static void grow() {
+        vector<T> **pool = new vector<T>*[ScratchVector::pool_size + 1];
+        std::copy(ScratchVector::pool, ScratchVector::pool + ScratchVector::pool_size, pool);
+        pool[ScratchVector::pool_size] = new vector<T>();
+
+        delete[] ScratchVector::pool;
+        ScratchVector::pool = pool;
+        ScratchVector::pool_size++;
+    }
+};
+
+template<typename T>
+thread_local vector<T> **ScratchVector<T>::pool = nullptr;
+
+template<typename T>
+thread_local int ScratchVector<T>::pool_size = 0;
+
+template<typename T>
+thread_local int ScratchVector<T>::depth = 0;
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include "ray.h"
+
+using glm::vec3;
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// The number of spheres a ray is tested against at once.
+const int sphere_batch_size = 8;
+
+// A ray prepared for being tested against many spheres, i.e. split into its
+// axes so they can be broadcast into SIMD lanes once per ray rather than once
+// per sphere.
+struct SphereTestRay {
+    float start[3];
+    // The direction of the ray normalised in 3D. Distances to spheres are
+    // measured along this direction, as in Sphere.
+    float dir[3];
+    // The length of the ray's direction in 3D. This converts normalised
+    // distances into multiples of the ray's direction.
+    float dir_length;
+
+    SphereTestRay(const Ray &ray) {
+        dir_length = glm::length(ray.dir);
+        for (int axis=0; axis<3; axis++) {
+            start[axis] = ray.start[axis];
+            dir[axis] = ray.dir[axis] / dir_length;
+        }
+    }
+};
+
+// param centers_x, centers_y, centers_z: the centers of the spheres.
+// param radii2: the squared radii of the spheres.
+// param count: the number of spheres to test, up to sphere_batch_size. The
+//              arrays must have sphere_batch_size readable entries, e.g. by
+//              padding them, although entries beyond count are ignored.
+// param norm_t_max: the end of the interval to test, along the normalised
+//                   direction of the ray.
+// param t_hit: set to the distance, along the normalised direction, to the
+//              nearest intersection in front of the start of the ray for each
+//              sphere that is hit.
+// return: a bitmask with bit i set if sphere i is hit within the interval.
+int intersect_spheres8(const SphereTestRay &ray, const float *centers_x, const float *centers_y, const float *centers_z, const float *radii2, int count, float norm_t_max, float t_hit[sphere_batch_size]) {
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+
+    // The offset, L, from the start of the ray to each center.
+    const __m256 lx = _mm256_sub_ps(_mm256_loadu_ps(centers_x), _mm256_set1_ps(ray.start[0]));
+    const __m256 ly = _mm256_sub_ps(_mm256_loadu_ps(centers_y), _mm256_set1_ps(ray.start[1]));
+    const __m256 lz = _mm256_sub_ps(_mm256_loadu_ps(centers_z), _mm256_set1_ps(ray.start[2]));
+
+    const __m256 dx = _mm256_set1_ps(ray.dir[0]);
+    const __m256 dy = _mm256_set1_ps(ray.dir[1]);
+    const __m256 dz = _mm256_set1_ps(ray.dir[2]);
+
+    // The distance along the ray to the point closest to each center, and the
+    // squared distance from that point to the center. As in Sphere, the
+    // latter is found from the offset between the two points.
+    const __m256 tca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, dx), _mm256_mul_ps(ly, dy)), _mm256_mul_ps(lz, dz));
+    const __m256 px = _mm256_sub_ps(lx, _mm256_mul_ps(tca, dx));
+    const __m256 py = _mm256_sub_ps(ly, _mm256_mul_ps(tca, dy));
+    const __m256 pz = _mm256_sub_ps(lz, _mm256_mul_ps(tca, dz));
+    const __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)), _mm256_mul_ps(pz, pz));
+
+    const __m256 r2 = _mm256_loadu_ps(radii2);
+    __m256 valid = _mm256_cmp_ps(d2, r2, _CMP_LE_OQ);
+
+    // Clamped so lanes which miss do not take the root of a negative number.
+    const __m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), zero));
+    const __m256 t0 = _mm256_sub_ps(tca, thc);
+    const __m256 t1 = _mm256_add_ps(tca, thc);
+
+    // Use the far root if the near root is behind the start of the ray.
+    const __m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, zero, _CMP_GT_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(norm_t_max), _CMP_LE_OQ));
+
+    _mm256_storeu_ps(t_hit, t);
+    // Lanes beyond count are ignored.
+    return _mm256_movemask_ps(valid) & ((1 << count) - 1);
+#else
+    // Without SIMD, most spheres are missed so it is cheaper to skip the
+    // square root for them than to avoid branching.
+    int mask = 0;
+    for (int i=0; i<count; i++) {
+        const float lx = centers_x[i] - ray.start[0];
+        const float ly = centers_y[i] - ray.start[1];
+        const float lz = centers_z[i] - ray.start[2];
+
+        const float tca = lx * ray.dir[0] + ly * ray.dir[1] + lz * ray.dir[2];
+        const float px = lx - tca * ray.dir[0];
+        const float py = ly - tca * ray.dir[1];
+        const float pz = lz - tca * ray.dir[2];
+        const float d2 = px * px + py * py + pz * pz;
+
+        if (d2 > radii2[i]) {
+            continue;
+        }
+
+        const float thc = std::sqrt(radii2[i] - d2);
+        const float t0 = tca - thc;
+        const float t1 = tca + thc;
+        const float t = t0 > 0.0f ? t0 : t1;
+
+        t_hit[i] = t;
+        mask |= (t > 0.0f && t <= norm_t_max) << i;
+    }
+    return mask;
+#endif
+}
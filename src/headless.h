@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <iostream>
+#include "omp.h"
+#include "rendering/renderer.h"
+#include "rendering/image_file.h"
+#include "rendering/heatmap.h"
+#include "models/scenes.h"
+
+using std::string;
+
+// Renders a single frame of a scene chosen on the command line, and writes
+// it to an image file, without opening a window. Used to render on machines
+// without a display, and to change the scene or quality without recompiling.
+namespace headless {
+    struct Options {
+        const char *scene = nullptr;
+        const char *mesh_path = "../mesh_files/model.obj";
+        const char *out = "render.ppm";
+        int width = 640;
+        int height = 512;
+        int samples = 1;
+        int bounces = 5;
+        int shadow_rays = 1;
+        // Zero to use every available thread.
+        int threads = 0;
+        // Whether samples is the most samples per pixel, taken until the
+        // error is below max_error, rather than the number taken.
+        bool adaptive = false;
+        float max_error = 0.01f;
+        // The file to write the cost of each pixel to as a heatmap, or
+        // nullptr to not measure the cost.
+        const char *heatmap = nullptr;
+        HeatmapCost cost = cost_time;
+    };
+
+    void print_usage(const char *program) {
+        printf("usage: %s --scene NAME [options]\n", program);
+        printf("  --width N          width of the image in pixels (640)\n");
+        printf("  --height N         height of the image in pixels (512)\n");
+        printf("  --spp N            primary rays per pixel (1)\n");
+        printf("  --adaptive         take up to --spp rays per pixel, until the error is small\n");
+        printf("  --error E          standard error at which adaptive sampling stops (0.01)\n");
+        printf("  --bounces N        maximum number of ray bounces (5)\n");
+        printf("  --shadow-rays N    shadow rays per light at each intersection (1)\n");
+        printf("  --threads N        threads to render with, 0 for all (0)\n");
+        printf("  --mesh PATH        the OBJ or PLY file for the mesh scene\n");
+        printf("  --out FILE         the .ppm or .bmp file to write (render.ppm)\n");
+        printf("  --heatmap FILE     also write the cost of each pixel as a heatmap\n");
+        printf("  --cost NAME        time, rays, tests, or steps, the cost shown by --heatmap (time)\n");
+        printf("scenes:\n");
+        scenes::print_names();
+    }
+
+    // param cost: set to the cost with the given name.
+    // return: whether the name is one of time, rays, tests, or steps.
+    bool parse_cost(const string &name, HeatmapCost &cost) {
+        if (name == "time") {
+            cost = cost_time;
+        } else if (name == "rays") {
+            cost = cost_rays;
+        } else if (name == "tests") {
+            cost = cost_tests;
+        } else if (name == "steps") {
+            cost = cost_march_steps;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // param options: set from the arguments.
+    // return: whether the arguments were valid.
+    bool parse(int argc, char *argv[], Options &options) {
+        for (int i=1; i<argc; i++) {
+            const string arg = argv[i];
+
+            if (arg == "--help") {
+                return false;
+            }
+            if (arg == "--adaptive") {
+                options.adaptive = true;
+                continue;
+            }
+
+            // Every other option takes a value.
+            if (i + 1 == argc) {
+                printf("Missing value for %s\n", argv[i]);
+                return false;
+            }
+            const char *value = argv[++i];
+
+            if (arg == "--scene") {
+                options.scene = value;
+            } else if (arg == "--mesh") {
+                options.mesh_path = value;
+            } else if (arg == "--out") {
+                options.out = value;
+            } else if (arg == "--width") {
+                options.width = atoi(value);
+            } else if (arg == "--height") {
+                options.height = atoi(value);
+            } else if (arg == "--spp") {
+                options.samples = atoi(value);
+            } else if (arg == "--bounces") {
+                options.bounces = atoi(value);
+            } else if (arg == "--shadow-rays") {
+                options.shadow_rays = atoi(value);
+            } else if (arg == "--threads") {
+                options.threads = atoi(value);
+            } else if (arg == "--error") {
+                options.max_error = atof(value);
+            } else if (arg == "--heatmap") {
+                options.heatmap = value;
+            } else if (arg == "--cost") {
+                if (!headless::parse_cost(value, options.cost)) {
+                    printf("Unknown cost: %s\n", value);
+                    return false;
+                }
+            } else {
+                printf("Unknown option: %s\n", argv[i - 1]);
+                return false;
+            }
+        }
+
+        if (options.scene == nullptr) {
+            printf("No scene given\n");
+            return false;
+        }
+        if (options.width <= 0 || options.height <= 0 || options.samples <= 0 || options.bounces < 0 || options.shadow_rays < 0 || options.threads < 0) {
+            printf("Sizes and samples must be positive, and other counts not negative\n");
+            return false;
+        }
+        if (!heatmap_cost_available(options.cost)) {
+            printf("Counting tests and march steps requires compiling with -DRAY_STATS=1\n");
+            return false;
+        }
+        return true;
+    }
+
+    // effect: renders the scene once into the screen's buffer.
+    void render_frame(Scene &scene, Camera &camera, screen *screen, const Options &options) {
+        if (options.adaptive) {
+            // At least two samples are needed to estimate the error.
+            const int max_samples = std::max(options.samples, 2);
+            const int min_samples = std::min(4, max_samples);
+            float mean_samples = render_adaptive(scene, camera, screen, min_samples, max_samples, options.max_error, options.shadow_rays);
+            printf("Mean samples per pixel: %.2f\n", mean_samples);
+        } else if (options.samples == 1) {
+            render_packets(scene, camera, screen, options.shadow_rays);
+        } else {
+            // Each frame jitters the primary rays across the pixel, so the
+            // mean is anti-aliased.
+            Accumulator accumulator = Accumulator(screen->width, screen->height);
+            for (int i=0; i<options.samples; i++) {
+                render_progressive(scene, camera, screen, accumulator, 1, options.shadow_rays);
+            }
+        }
+    }
+
+    // return: whether the screen was written to the file, as a .bmp if the
+    //         file has that extension, otherwise as a .ppm.
+    bool save_image(screen *screen, const char *filename) {
+        const size_t length = strlen(filename);
+        if (length >= 4 && strcmp(filename + length - 4, ".bmp") == 0) {
+            return save_bmp(screen, filename);
+        }
+        return save_ppm(screen, filename);
+    }
+
+    // return: the exit code of the program, which is non-zero if the
+    //         arguments were invalid or the image could not be written.
+    int run(int argc, char *argv[]) {
+        Options options;
+        if (!headless::parse(argc, argv, options)) {
+            headless::print_usage(argv[0]);
+            return 1;
+        }
+
+        const scenes::NamedScene *named = scenes::find(options.scene);
+        if (named == nullptr) {
+            printf("Unknown scene: %s\n", options.scene);
+            headless::print_usage(argv[0]);
+            return 1;
+        }
+
+        if (options.threads > 0) {
+            omp_set_num_threads(options.threads);
+        }
+
+        Scene scene = named->make(options.mesh_path);
+        Camera camera = Camera(vec4(0, 0, -2.3, 1), options.width / 2, options.bounces);
+
+        // Only the buffer is used, as no window is opened.
+        screen image;
+        memset(&image, 0, sizeof(image));
+        image.width = options.width;
+        image.height = options.height;
+        image.buffer = new uint32_t[options.width * options.height];
+
+        auto start = std::chrono::steady_clock::now();
+        headless::render_frame(scene, camera, &image, options);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        printf("Render time: %.1f ms\n", elapsed.count());
+
+        bool saved = headless::save_image(&image, options.out);
+        const char *unsaved = saved ? nullptr : options.out;
+
+        if (options.heatmap != nullptr) {
+            // Rendered again, one pixel at a time, so the image above is not
+            // slowed down by measuring the cost.
+            CostMap costs = CostMap(options.width, options.height);
+            render_cost(scene, camera, &image, costs, options.cost, options.samples, options.shadow_rays);
+            costs.print(std::cout);
+
+            draw_heatmap(&image, costs);
+            if (!headless::save_image(&image, options.heatmap)) {
+                saved = false;
+                unsaved = options.heatmap;
+            }
+        }
+
+        delete[] image.buffer;
+
+        if (!saved) {
+            printf("Unable to write image: %s\n", unsaved);
+            return 1;
+        }
+        return 0;
+    }
+}
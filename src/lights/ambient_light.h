@@ -36,8 +36,7 @@ public:
         return std::nullopt;
     }
 
-    // return: the empty vector because ambient lights cannot cast shadows.
-    vector<Ray> random_shadow_rays_from(vec4 point, int num) const {
-        return vector<Ray>();
+    // effect: adds nothing because ambient lights cannot cast shadows.
+    void random_shadow_rays_from(vec4 point, int num, vector<Ray> &rays) const {
     }
 };
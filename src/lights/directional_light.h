@@ -1,6 +1,7 @@
 #pragma once
 
 #include "light.h"
+#include "../geometry/ray_stats.h"
 
 class DirectionalLight: public Light {
 public:
@@ -44,25 +45,22 @@ public:
     // return: a shadow ray from the point and the light source. Or, returns
     //         nothing if the light does not cast shadows.
     optional<Ray> ray_from(vec4 point) const {
-        return Ray(point, this->normalised_dir * this->shadow_ray_len, 0);
+        return Ray(vec3(point), vec3(this->normalised_dir * this->shadow_ray_len), 0, 1.0f);
     }
 
-    // return: a number of randomly selected shadow rays from an area around
-    //         the light to the point. Or, returns nothing if the light does
-    //         not cast shadows.
-    vector<Ray> random_shadow_rays_from(vec4 point, int num) const {
+    // effect: adds a number of randomly selected shadow rays from an area
+    //         around the light to the point.
+    void random_shadow_rays_from(vec4 point, int num, vector<Ray> &rays) const {
+        COUNT_RAY_STAT(stat_shadow_rays, num);
         // The center of the sphere used to draw shadow rays to.
         vec3 center_3d = vec3(point - this->normalised_dir);
 
-        vector<Ray> rays;
         for (int i=0; i<num; i++) {
             vec3 point_in_sphere_3d = random_in_sphere(center_3d, this->radius);
             vec4 point_in_sphere = project_to_4D(point_in_sphere_3d);
 
             vec4 dir = (point - point_in_sphere) * this->shadow_ray_len;
-            rays.push_back(Ray(point, dir, 0));
+            rays.push_back(Ray(vec3(point), vec3(dir), 0, 1.0f));
         }
-
-        return rays;
     }
 };
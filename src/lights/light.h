@@ -31,8 +31,10 @@ public:
     //         light cannot cast rays, e.g. ambient lighting.
     virtual optional<Ray> ray_from(vec4 point) const = 0;
 
-    // return: a number of randomly selected shadow rays from an area around
-    //         the light to the point. Or, the empty vector if the light
+    // param rays: the buffer to add the rays to, e.g. a ScratchVector, so
+    //             that no memory is allocated once it is large enough.
+    // effect: adds a number of randomly selected shadow rays from an area
+    //         around the light to the point. Or, adds nothing if the light
     //         cannot cast shadows, e.g. ambient lighting.
-    virtual vector<Ray> random_shadow_rays_from(vec4 point, int num) const = 0;
+    virtual void random_shadow_rays_from(vec4 point, int num, vector<Ray> &rays) const = 0;
 };
@@ -4,6 +4,7 @@
 #include "../geometry/random.h"
 #include "../geometry/projection.h"
 #include "light.h"
+#include "../geometry/ray_stats.h"
 
 // Models a point light which radiates light outwards.
 class PointLight: public Light {
@@ -39,7 +40,7 @@ public:
     //         on the angle of the surface to the light.
     float projection_factor(vec4 position, vec4 surface_normal) const {
         Ray shadow_ray = this->ray_from(position).value(); // Because we know it has a value.
-        vec4 shadow_ray_dir = shadow_ray.normalized_dir;
+        vec4 shadow_ray_dir = vec4(shadow_ray.normalized_dir(), 0.0f);
         // The proportion of light hitting the surface.
         float prop = dot(normalize(surface_normal), shadow_ray_dir);
         // Because negative light is not allowed.
@@ -51,23 +52,22 @@ public:
     optional<Ray> ray_from(vec4 point) const {
         // The ray can only be used to check obstructions between the point and
         // light. Therefore it cannot bounce.
-        return Ray(point, this->pos - point, 0);
+        return Ray(vec3(point), vec3(this->pos - point), 0, 1.0f);
     }
 
-    // return: the given number of rays to points within the radius of the light.
-    vector<Ray> random_shadow_rays_from(vec4 point, int num) const {
+    // effect: adds the given number of rays to points within the radius of
+    //         the light.
+    void random_shadow_rays_from(vec4 point, int num, vector<Ray> &rays) const {
+        COUNT_RAY_STAT(stat_shadow_rays, num);
         // The ray can only be used to check obstructions between the point and
         // light. Therefore it cannot bounce.
         vec3 center_3d = vec3(this->pos);
 
-        vector<Ray> rays;
         for (int i=0; i<num; i++) {
             vec3 point_in_sphere_3d = random_in_sphere(center_3d, this->radius);
             vec4 point_in_sphere = project_to_4D(point_in_sphere_3d);
 
-            rays.push_back(Ray(point, point_in_sphere - point, 0));
+            rays.push_back(Ray(vec3(point), vec3(point_in_sphere - point), 0, 1.0f));
         }
-
-        return rays;
     }
 };
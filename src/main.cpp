@@ -18,17 +18,11 @@
 #include "shaders/projection.h"
 #include "rendering/renderer.h"
 
-#include "models/cornel_box.h"
-#include "models/textured_test_model.h"
-#include "models/saturn_model.h"
-#include "models/sphere_model.h"
-#include "models/star_model.h"
-#include "models/volume_model.h"
-#include "models/interstellar_cloud.h"
-#include "models/procedural_volume_model.h"
-#include "models/transparency_model.h"
-#include "models/gravitational_lens_model.h"
-#include "models/supernova_model.h"
+#include "rendering/stats_overlay.h"
+#include "rendering/heatmap.h"
+
+#include "models/scenes.h"
+#include "headless.h"
 
 #include <glm/glm.hpp>
 #include <SDL.h>
@@ -39,9 +33,43 @@
 #define MAX_NUM_RAY_BOUNCES 5
 #define NUM_SHADOW_RAYS 1
 #define NUM_SAMPLES 1
+// Trace primary rays in packets, only used with one sample per pixel.
+#define USE_RAY_PACKETS true
+// Shade the packets breadth first, sorted by shader. Requires USE_RAY_PACKETS.
+#define USE_WAVEFRONT false
+// Print how long each thread was idle for in each frame. Only used when the
+// frame is rendered in tiles, i.e. when accumulating frames, sampling
+// adaptively, or not using ray packets.
+#define REPORT_UTILISATION false
+// Average the frames rendered while the camera and lights are still, adding
+// NUM_SAMPLES new samples per pixel each frame. Off by default, as it takes
+// priority over the packet and wavefront renderers.
+#define ACCUMULATE_FRAMES false
+// Fire batches of ADAPTIVE_MIN_SAMPLES primary rays at each pixel until the
+// standard error of its colour is below ADAPTIVE_MAX_ERROR, or it has had
+// ADAPTIVE_MAX_SAMPLES rays. Used instead of NUM_SAMPLES when not
+// accumulating frames.
+#define ADAPTIVE_SAMPLING false
+#define ADAPTIVE_MIN_SAMPLES 4
+#define ADAPTIVE_MAX_SAMPLES 64
+#define ADAPTIVE_MAX_ERROR 0.01f
+// Print the work done for each frame, e.g. the rays of each type and the
+// box and primitive tests. Only the total number of rays is counted unless
+// compiled with -DRAY_STATS=1.
+#define PRINT_RAY_STATS false
+// Draw the work done for each frame as bars over the image, as described in
+// draw_stats_overlay. Requires RAY_STATS.
+#define RAY_STATS_OVERLAY false
+// Show the cost of rendering each pixel as a false colour heatmap instead of
+// the image, e.g. to find the models and shaders to optimise. Costs other
+// than cost_time and cost_rays require RAY_STATS.
+#define SHOW_HEATMAP false
+#define HEATMAP_COST cost_time
 
 // /*Place updates of parameters here*/
-void update(Camera &camera, Scene &scene) {
+// return: whether the camera or lights moved, in which case the frames
+//         accumulated so far are out of date.
+bool update(Camera &camera, Scene &scene) {
     static int t = SDL_GetTicks();
     /* Compute frame time */
     int t2 = SDL_GetTicks();
@@ -57,6 +85,9 @@ void update(Camera &camera, Scene &scene) {
     const float yaw_delta = 0.02f;
     const float light_move_delta = 0.05f;
 
+    const Camera previous_camera = camera;
+    bool changed = false;
+
     // Camera movement
     if(scancodes[SDL_SCANCODE_DOWN])  camera.move_forward(-cam_move_delta); // Backwards
     if(scancodes[SDL_SCANCODE_UP])    camera.move_forward(cam_move_delta);  // Forwards
@@ -66,21 +97,32 @@ void update(Camera &camera, Scene &scene) {
     if(scancodes[SDL_SCANCODE_S])     camera.move_down(cam_move_delta);     // Down
     if(scancodes[SDL_SCANCODE_LEFT])  camera.turn(-yaw_delta);              // Pan Left
     if(scancodes[SDL_SCANCODE_RIGHT]) camera.turn(yaw_delta);               // Pan Right
+    changed = camera != previous_camera;
 
     // Light movement.
     // Try getting the first light as a point light which can be moved.
     PointLight* light = dynamic_cast<PointLight*>(scene.lights[0]);
     if (light != NULL) {
+        const vec4 previous_pos = light->pos;
         if(scancodes[SDL_SCANCODE_I]) light->pos.y -= light_move_delta; // Up
         if(scancodes[SDL_SCANCODE_K]) light->pos.y += light_move_delta; // Down
         if(scancodes[SDL_SCANCODE_J]) light->pos.x -= light_move_delta; // Left
         if(scancodes[SDL_SCANCODE_L]) light->pos.x += light_move_delta; // Right
         if(scancodes[SDL_SCANCODE_U]) light->pos.z -= light_move_delta; // Backwards
         if(scancodes[SDL_SCANCODE_O]) light->pos.z += light_move_delta; // Forwards
+        changed = changed || light->pos != previous_pos;
     }
+
+    return changed;
 }
 
+// Given any arguments, e.g. --scene cornel, renders one frame without a
+// window and writes it to a file. Run with --help for the options.
 int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        return headless::run(argc, argv);
+    }
+
     //Scene scene = cornel_box();
     Scene scene = textured_test_scene();
     //Scene scene = saturn_scene();
@@ -92,13 +134,48 @@ int main(int argc, char* argv[]) {
     //Scene scene = transparency_demo::scene();
     //Scene scene = gravitational_lens::scene();
     //Scene scene = supernova_model::scene();
+    //Scene scene = mesh_model::scene("../mesh_files/model.obj");
+    //Scene scene = star_field_model::scene();
+    //Scene scene = star_field_model::clusters_scene();
     Camera cam = Camera(vec4(0, 0, -2.3, 1), SCREEN_WIDTH / 2, MAX_NUM_RAY_BOUNCES);
     //Camera cam = Camera(vec4(0, 0, -1.5, 1), SCREEN_WIDTH / 2, MAX_NUM_RAY_BOUNCES);
     screen *screen = InitializeSDL(SCREEN_WIDTH, SCREEN_HEIGHT, FULLSCREEN_MODE);
+    Accumulator accumulator = Accumulator(SCREEN_WIDTH, SCREEN_HEIGHT);
+    CostMap costs = CostMap(SCREEN_WIDTH, SCREEN_HEIGHT);
 
     while (NoQuitMessageSDL()) {
-        update(cam, scene);
-        render(scene, cam, screen, NUM_SAMPLES, NUM_SHADOW_RAYS);
+        if (update(cam, scene)) {
+            accumulator.reset();
+        }
+        RayStats::reset();
+
+        if (SHOW_HEATMAP) {
+            render_cost(scene, cam, screen, costs, HEATMAP_COST, NUM_SAMPLES, NUM_SHADOW_RAYS);
+            draw_heatmap(screen, costs);
+        } else if (ACCUMULATE_FRAMES) {
+            render_progressive(scene, cam, screen, accumulator, NUM_SAMPLES, NUM_SHADOW_RAYS);
+        } else if (ADAPTIVE_SAMPLING) {
+            float mean_samples = render_adaptive(scene, cam, screen, ADAPTIVE_MIN_SAMPLES, ADAPTIVE_MAX_SAMPLES, ADAPTIVE_MAX_ERROR, NUM_SHADOW_RAYS);
+            std::cout << "Mean samples per pixel: " << mean_samples << std::endl;
+        } else if (USE_RAY_PACKETS && USE_WAVEFRONT && NUM_SAMPLES == 1) {
+            render_wavefront(scene, cam, screen, NUM_SHADOW_RAYS);
+        } else if (USE_RAY_PACKETS && NUM_SAMPLES == 1) {
+            render_packets(scene, cam, screen, NUM_SHADOW_RAYS);
+        } else {
+            render(scene, cam, screen, NUM_SAMPLES, NUM_SHADOW_RAYS);
+        }
+
+        if (REPORT_UTILISATION && (SHOW_HEATMAP || ACCUMULATE_FRAMES || ADAPTIVE_SAMPLING || !USE_RAY_PACKETS || NUM_SAMPLES != 1)) {
+            render_scheduler().report(std::cout);
+        }
+
+        const FrameStats stats = RayStats::total();
+        if (PRINT_RAY_STATS) {
+            stats.print(std::cout);
+        }
+        if (RAY_STATS && RAY_STATS_OVERLAY) {
+            draw_stats_overlay(screen, stats);
+        }
         SDL_Renderframe(screen);
     }
 }
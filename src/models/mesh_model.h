@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../geometry/mesh_file.h"
+
+namespace mesh_model {
+    // param path: the OBJ or PLY file containing the mesh.
+    // return: the mesh in the file, as a single object.
+    Object *mesh(const char *path) {
+        const Shader *shader = new Diffuse(vec3(0.75f, 0.75f, 0.75f));
+        return new Object(MeshFile::load(path, shader));
+    }
+
+    const Object **objects(const char *path) {
+        const Object **objects = new const Object*[1];
+        objects[0] = mesh(path);
+        return objects;
+    }
+
+    // return: the lights in the scene, placed as in the cornel box.
+    vector<Light*> lights() {
+        vector<Light*> lights;
+
+        PointLight *light = new PointLight(vec3(18, 18, 18), vec4(0, -0.5, -0.7, 1.0), 0.1f);
+        AmbientLight *ambient = new AmbientLight(vec3(0.2f, 0.2f, 0.2f));
+
+        lights.push_back(light);
+        lights.push_back(ambient);
+
+        return lights;
+    }
+
+    // param path: the OBJ or PLY file containing the mesh. The mesh is not
+    //             moved or scaled, so should be modelled to fit in the view of
+    //             the camera, with y pointing down.
+    // return: a scene containing the mesh in the file.
+    Scene scene(const char *path) {
+        return Scene(1, objects(path), lights());
+    }
+}
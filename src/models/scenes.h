@@ -0,0 +1,67 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "cornel_box.h"
+#include "textured_test_model.h"
+#include "saturn_model.h"
+#include "sphere_model.h"
+#include "star_model.h"
+#include "volume_model.h"
+#include "interstellar_cloud.h"
+#include "procedural_volume_model.h"
+#include "transparency_model.h"
+#include "gravitational_lens_model.h"
+#include "supernova_model.h"
+#include "mesh_model.h"
+#include "star_field_model.h"
+
+// The models which can be chosen by name, e.g. when rendering from the
+// command line.
+namespace scenes {
+    struct NamedScene {
+        const char *name;
+        // param mesh_path: the mesh file to load, only used by the mesh scene.
+        Scene (*make)(const char *mesh_path);
+    };
+
+    const NamedScene all[] = {
+        {"cornel",       [](const char*) { return cornel_box(); }},
+        {"textured",     [](const char*) { return textured_test_scene(); }},
+        {"saturn",       [](const char*) { return saturn_scene(); }},
+        {"sphere",       [](const char*) { return sphere_scene(); }},
+        {"star",         [](const char*) { return star_scene(); }},
+        {"volume",       [](const char*) { return volume_scene(); }},
+        {"cloud",        [](const char*) { return interstellar_cloud::scene(); }},
+        {"procvol",      [](const char*) { return procedural_volume::scene(); }},
+        {"transparency", [](const char*) { return transparency_demo::scene(); }},
+        {"lens",         [](const char*) { return gravitational_lens::scene(); }},
+        {"supernova",    [](const char*) { return supernova_model::scene(); }},
+        {"mesh",         [](const char *mesh_path) { return mesh_model::scene(mesh_path); }},
+        {"stars",        [](const char*) { return star_field_model::scene(); }},
+        {"clusters",     [](const char*) { return star_field_model::clusters_scene(); }},
+    };
+
+    const int num_scenes = sizeof(all) / sizeof(all[0]);
+
+    // return: the scene with the given name, or nullptr if there is none.
+    const NamedScene *find(const char *name) {
+        for (int i=0; i<num_scenes; i++) {
+            if (strcmp(all[i].name, name) == 0) {
+                return &all[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // effect: prints the names of all the scenes.
+    void print_names() {
+        for (int i=0; i<num_scenes; i++) {
+            printf("  %s\n", all[i].name);
+        }
+    }
+}
+
+#endif // SCENES_H
@@ -0,0 +1,82 @@
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../geometry/scene_builder.h"
+
+#ifndef STAR_FIELD_MODEL_H
+#define STAR_FIELD_MODEL_H
+
+namespace star_field_model {
+    // effect: adds an object containing small spheres scattered in front of
+    //         the camera. The positions are the same each time the field is
+    //         made.
+    // param num_stars: the number of spheres in the field.
+    void add_stars(SceneBuilder &builder, int num_stars) {
+        const Shader *shader = builder.shader<FlatColor>(vec3(1.0f, 1.0f, 1.0f), 0.0f);
+
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> spread(-4.0f, 4.0f);
+        std::uniform_real_distribution<float> depth(1.0f, 12.0f);
+        std::uniform_real_distribution<float> size(0.002f, 0.01f);
+
+        vector<Primitive*> primitives;
+        primitives.reserve(num_stars);
+        for (int i=0; i<num_stars; i++) {
+            vec4 center = vec4(spread(rng), spread(rng), depth(rng), 1.0f);
+            primitives.push_back(builder.primitive<Sphere>(center, size(rng), shader));
+        }
+
+        builder.add_object(primitives);
+    }
+
+    // effect: adds clusters of small spheres scattered in front of the
+    //         camera. Every cluster is an instance of the same spheres, with
+    //         its own position and rotation, so only one cluster is stored
+    //         however many there are.
+    // param num_clusters: the number of clusters in the field.
+    // param stars_per_cluster: the number of spheres in each cluster.
+    void add_star_clusters(SceneBuilder &builder, int num_clusters, int stars_per_cluster) {
+        const Shader *shader = builder.shader<FlatColor>(vec3(1.0f, 1.0f, 1.0f), 0.0f);
+
+        std::mt19937 rng(2);
+        std::uniform_real_distribution<float> spread(-4.0f, 4.0f);
+        std::uniform_real_distribution<float> depth(1.0f, 12.0f);
+        std::uniform_real_distribution<float> offset(-0.2f, 0.2f);
+        std::uniform_real_distribution<float> size(0.002f, 0.01f);
+        std::uniform_real_distribution<float> angle(0.0f, 2 * M_PI);
+
+        vector<Primitive*> primitives;
+        primitives.reserve(stars_per_cluster);
+        for (int i=0; i<stars_per_cluster; i++) {
+            vec4 center = vec4(offset(rng), offset(rng), offset(rng), 1.0f);
+            primitives.push_back(builder.primitive<Sphere>(center, size(rng), shader));
+        }
+        const Object *cluster = builder.prototype(primitives);
+
+        for (int i=0; i<num_clusters; i++) {
+            const vec3 position = vec3(spread(rng), spread(rng), depth(rng));
+            const vec3 axis = vec3(offset(rng), offset(rng), offset(rng));
+            const mat4 transform = glm::translate(mat4(1.0f), position) * glm::rotate(mat4(1.0f), angle(rng), axis);
+            builder.add_instance(cluster, transform);
+        }
+    }
+
+    // return: a scene made up of a large number of spheres, used to measure
+    //         the speed of intersecting spheres.
+    Scene scene(int num_stars = 1000000) {
+        SceneBuilder builder;
+        add_stars(builder, num_stars);
+        builder.light<AmbientLight>(vec3(1.0f, 1.0f, 1.0f));
+        return builder.build();
+    }
+
+    // return: a scene made up of many instances of a cluster of spheres,
+    //         which takes little more memory than a single cluster.
+    Scene clusters_scene(int num_clusters = 10000, int stars_per_cluster = 100) {
+        SceneBuilder builder;
+        add_star_clusters(builder, num_clusters, stars_per_cluster);
+        builder.light<AmbientLight>(vec3(1.0f, 1.0f, 1.0f));
+        return builder.build();
+    }
+}
+
+#endif // STAR_FIELD_MODEL_H
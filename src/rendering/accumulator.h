@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+using glm::vec3;
+
+// Keeps the total colour of every pixel over the frames rendered since the
+// camera, lights, or scene last changed. Each frame adds new samples, e.g.
+// jittered primary rays and random shadow rays, and the mean of all the
+// samples so far is displayed. Therefore the image keeps improving while
+// nothing moves, without needing many samples per frame.
+class Accumulator {
+private:
+    int width;
+    // The sum of the colours added to each pixel, row by row.
+    vec3 *sums;
+    // The number of frames added to the sums.
+    int num_frames;
+
+public:
+    Accumulator(int width, int height):
+        width(width), sums(new vec3[width * height]), num_frames(0)
+    {
+    }
+
+    Accumulator(const Accumulator&) = delete;
+    Accumulator &operator=(const Accumulator&) = delete;
+
+    ~Accumulator() {
+        delete[] this->sums;
+    }
+
+    // effect: discards the frames added so far, e.g. because the camera
+    //         moved. The sums are overwritten by the next frame, so do not
+    //         need clearing.
+    void reset() {
+        this->num_frames = 0;
+    }
+
+    // return: the number of frames added since the last reset.
+    int frames() const {
+        return this->num_frames;
+    }
+
+    // effect: adds the colour of the pixel in the current frame. Each pixel
+    //         is only added to by one thread, so no locking is needed.
+    // return: the mean colour of the pixel, including the current frame.
+    vec3 add(int x, int y, vec3 color) {
+        vec3 &sum = this->sums[y * this->width + x];
+        sum = this->num_frames == 0 ? color : sum + color;
+        return sum / (float)(this->num_frames + 1);
+    }
+
+    // effect: marks every pixel of the current frame as added.
+    void end_frame() {
+        this->num_frames++;
+    }
+};
@@ -16,13 +16,32 @@ public:
     }
 
     Ray primary_ray(int pixel_x, int pixel_y, int screen_width, int screen_height) {
-        float camera_x = pixel_x - screen_width / 2;
-        float camera_y = pixel_y - screen_height / 2;
+        return this->primary_ray_at((float)pixel_x, (float)pixel_y, screen_width, screen_height);
+    }
+
+    // return: the ray through the point (x, y) on the screen, where pixel
+    //         centers are a whole number of units apart. Used to jitter rays
+    //         within a pixel.
+    Ray primary_ray_at(float x, float y, int screen_width, int screen_height) {
+        COUNT_RAY_STAT(stat_primary_rays, 1);
+        COUNT_BOUNCE(this->max_ray_bounces);
+        float camera_x = x - (float)(screen_width / 2);
+        float camera_y = y - (float)(screen_height / 2);
 
         vec4 dir = vec4(camera_x - this->pos.x, camera_y - this->pos.y, this->focal_length - this->pos.z, 1);
         vec4 rotated_dir = this->yaw_matrix() * dir;
 
-        return Ray(this->pos, rotated_dir, this->max_ray_bounces);
+        return Ray(vec3(this->pos), vec3(rotated_dir), this->max_ray_bounces);
+    }
+
+    // return: whether the cameras are in the same place and facing the same
+    //         way, so would render the same image.
+    bool operator==(const Camera &other) const {
+        return this->pos == other.pos && this->yaw == other.yaw && this->focal_length == other.focal_length;
+    }
+
+    bool operator!=(const Camera &other) const {
+        return !(*this == other);
     }
 
     // effect: moves the camera relative to the direction it is facing.
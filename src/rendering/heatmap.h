@@ -0,0 +1,198 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+#include "omp.h"
+#include "SDLauxiliary.h"
+#include "renderer.h"
+#include "tile_scheduler.h"
+#include "../geometry/ray_stats.h"
+
+using glm::vec3;
+using std::vector;
+
+// The measure of the work done to render a pixel. Only time and rays are
+// available unless compiled with RAY_STATS.
+enum HeatmapCost {
+    // The time taken to render the pixel, in seconds.
+    cost_time,
+    // The rays traced through the scene, of any type.
+    cost_rays,
+    // The box and primitive tests of all the rays.
+    cost_tests,
+    // The steps taken marching rays through volumes.
+    cost_march_steps
+};
+
+// return: whether the cost can be measured in this build.
+bool heatmap_cost_available(HeatmapCost cost) {
+    return RAY_STATS || cost == cost_time || cost == cost_rays;
+}
+
+// The work done to render each pixel of a frame, e.g. to find which parts
+// of which models are the most expensive to render.
+class CostMap {
+private:
+    int width, height;
+    // The cost of each pixel, row by row.
+    vector<double> costs;
+
+public:
+    CostMap(int width, int height):
+        width(width), height(height), costs(width * height, 0.0)
+    {
+    }
+
+    int get_width() const {
+        return this->width;
+    }
+
+    int get_height() const {
+        return this->height;
+    }
+
+    double at(int x, int y) const {
+        return this->costs[y * this->width + x];
+    }
+
+    void set(int x, int y, double cost) {
+        this->costs[y * this->width + x] = cost;
+    }
+
+    // return: the cost of the work done between two totals of one thread.
+    static double difference(HeatmapCost cost, const FrameStats &before, const FrameStats &after) {
+        switch (cost) {
+            case cost_rays:
+                return after.rays - before.rays;
+            case cost_tests: {
+                long tests = 0;
+                for (int s=stat_box_tests; s<=stat_other_tests; s++) {
+                    tests += after.counts[s] - before.counts[s];
+                }
+                return tests;
+            }
+            case cost_march_steps:
+                return after.counts[stat_march_steps] - before.counts[stat_march_steps];
+            default:
+                return 0.0;
+        }
+    }
+
+    // effect: writes a summary of how unevenly the cost is spread, i.e. the
+    //         ratio of the most expensive to the median pixel, the share of
+    //         the total cost in the most expensive 1% of pixels, and the same
+    //         for the tiles shared between threads.
+    void print(std::ostream &out) const {
+        vector<double> pixels = this->costs;
+        std::sort(pixels.begin(), pixels.end());
+
+        vector<double> tiles;
+        for (int y0=0; y0<this->height; y0+=tile_width) {
+            for (int x0=0; x0<this->width; x0+=tile_width) {
+                double tile_cost = 0.0;
+                for (int y=y0; y<std::min(y0 + tile_width, this->height); y++) {
+                    for (int x=x0; x<std::min(x0 + tile_width, this->width); x++) {
+                        tile_cost += this->at(x, y);
+                    }
+                }
+                tiles.push_back(tile_cost);
+            }
+        }
+        std::sort(tiles.begin(), tiles.end());
+
+        auto print_spread = [&](const char *name, const vector<double> &sorted) {
+            double total = 0.0, top_total = 0.0;
+            const size_t top = std::max<size_t>(1, sorted.size() / 100);
+            for (size_t i=0; i<sorted.size(); i++) {
+                total += sorted[i];
+                if (i >= sorted.size() - top) {
+                    top_total += sorted[i];
+                }
+            }
+
+            const double median = sorted[sorted.size() / 2];
+            out << std::setw(8) << name
+                << "  total " << std::setw(12) << total
+                << "  max/median " << std::setw(10) << (median > 0.0 ? sorted.back() / median : 0.0)
+                << "  top 1% share " << std::setw(6) << std::setprecision(3) << (total > 0.0 ? top_total / total : 0.0)
+                << std::setprecision(6) << std::endl;
+        };
+
+        print_spread("pixels", pixels);
+        print_spread("tiles", tiles);
+    }
+};
+
+// effect: renders the scene to the screen buffer as render does, and sets
+//         the cost of each pixel in costs, which must be the same size as
+//         the screen. Pixels are timed or counted one at a time, so this is
+//         slower than render and only meant for finding expensive pixels.
+void render_cost(Scene &scene, Camera &camera, screen* screen, CostMap &costs, HeatmapCost cost, const int num_samples, const int num_shadow_rays) {
+    auto render_tile = [&](const Tile &tile) {
+        for (int y=tile.y0; y<tile.y1; y++) {
+            for (int x=tile.x0; x<tile.x1; x++) {
+                // Copied, as the thread's totals are updated while rendering.
+                const FrameStats before = RayStats::thread_total();
+                const double start = omp_get_wtime();
+
+                vec3 color = mean_pixel_color(scene, camera, screen, x, y, num_samples, num_shadow_rays);
+
+                if (cost == cost_time) {
+                    costs.set(x, y, omp_get_wtime() - start);
+                } else {
+                    costs.set(x, y, CostMap::difference(cost, before, RayStats::thread_total()));
+                }
+                PutPixelSDL(screen, x, y, color);
+            }
+        }
+    };
+
+    render_scheduler().render(screen->width, screen->height, render_tile);
+}
+
+// return: the false colour of t, from zero to one, going from black through
+//         blue, magenta, red, and yellow to white as t increases.
+vec3 heat_color(float t) {
+    static const vec3 stops[] = {
+        vec3(0, 0, 0), vec3(0, 0, 1), vec3(1, 0, 1), vec3(1, 0, 0), vec3(1, 1, 0), vec3(1, 1, 1)
+    };
+    const int num_stops = sizeof(stops) / sizeof(stops[0]);
+
+    const float scaled = glm::clamp(t, 0.0f, 1.0f) * (num_stops - 1);
+    const int i = std::min((int)scaled, num_stops - 2);
+    return glm::mix(stops[i], stops[i + 1], scaled - i);
+}
+
+// effect: draws the costs to the screen as a false colour heatmap. The
+//         colours are on a log scale, from the cheapest pixel which did any
+//         work to the most expensive, as the costs can differ by factors of
+//         thousands. Pixels which did no work are black.
+void draw_heatmap(screen *screen, const CostMap &costs) {
+    double min_cost = 0.0, max_cost = 0.0;
+    for (int y=0; y<costs.get_height(); y++) {
+        for (int x=0; x<costs.get_width(); x++) {
+            const double cost = costs.at(x, y);
+            if (cost > 0.0 && (min_cost == 0.0 || cost < min_cost)) {
+                min_cost = cost;
+            }
+            max_cost = std::max(max_cost, cost);
+        }
+    }
+
+    // Used to avoid dividing by zero if every pixel did the same work.
+    const double log_range = std::max(log(max_cost / min_cost), 1e-6);
+
+    for (int y=0; y<costs.get_height(); y++) {
+        for (int x=0; x<costs.get_width(); x++) {
+            const double cost = costs.at(x, y);
+            // The cheapest pixels are dark blue rather than black, so they
+            // can be told apart from pixels which did no work.
+            const float t = cost > 0.0 ? 0.1f + 0.9f * (float)(log(cost / min_cost) / log_range) : 0.0f;
+            PutPixelSDL(screen, x, y, heat_color(t));
+        }
+    }
+}
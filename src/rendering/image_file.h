@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdio>
+#include <stdint.h>
+#include "SDLauxiliary.h"
+
+// param filename: the file to write, which is replaced if it exists.
+// return: whether the screen buffer was written to the file as a binary PPM
+//         image. Unlike SDL_SaveImage, no SDL surface is needed, so this
+//         can be used without a window.
+bool save_ppm(const screen *s, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", s->width, s->height);
+
+    unsigned char *row = new unsigned char[3 * s->width];
+    bool written = true;
+    for (int y=0; y<s->height && written; y++) {
+        for (int x=0; x<s->width; x++) {
+            // Pixels are stored as ARGB, as written by PutPixelSDL.
+            const uint32_t pixel = s->buffer[y * s->width + x];
+            row[3 * x + 0] = (pixel >> 16) & 0xff;
+            row[3 * x + 1] = (pixel >> 8) & 0xff;
+            row[3 * x + 2] = pixel & 0xff;
+        }
+        written = fwrite(row, 3, s->width, file) == (size_t)s->width;
+    }
+
+    delete[] row;
+    return fclose(file) == 0 && written;
+}
+
+// effect: writes value to bytes as a little endian number of num_bytes bytes.
+void put_little_endian(unsigned char *bytes, uint32_t value, int num_bytes) {
+    for (int i=0; i<num_bytes; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+// param filename: the file to write, which is replaced if it exists.
+// return: whether the screen buffer was written to the file as a 24 bit BMP
+//         image. As with save_ppm, no SDL surface is needed, and unlike
+//         SDL_SaveImage, failing to write the file is returned rather than
+//         exiting.
+bool save_bmp(const screen *s, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    // Rows are padded to a multiple of four bytes.
+    const int row_size = (3 * s->width + 3) / 4 * 4;
+    const int header_size = 14 + 40;
+    const uint32_t image_size = row_size * s->height;
+
+    // The file header, followed by a BITMAPINFOHEADER. Unset fields, e.g.
+    // the compression and resolution, are zero.
+    unsigned char header[header_size] = {'B', 'M'};
+    put_little_endian(&header[2], header_size + image_size, 4);
+    put_little_endian(&header[10], header_size, 4);
+    put_little_endian(&header[14], 40, 4);
+    put_little_endian(&header[18], s->width, 4);
+    put_little_endian(&header[22], s->height, 4);
+    put_little_endian(&header[26], 1, 2);
+    put_little_endian(&header[28], 24, 2);
+    put_little_endian(&header[34], image_size, 4);
+
+    bool written = fwrite(header, 1, header_size, file) == (size_t)header_size;
+
+    unsigned char *row = new unsigned char[row_size]();
+    // Rows are stored from the bottom of the image up, as BGR.
+    for (int y=s->height-1; y>=0 && written; y--) {
+        for (int x=0; x<s->width; x++) {
+            const uint32_t pixel = s->buffer[y * s->width + x];
+            row[3 * x + 0] = pixel & 0xff;
+            row[3 * x + 1] = (pixel >> 8) & 0xff;
+            row[3 * x + 2] = (pixel >> 16) & 0xff;
+        }
+        written = fwrite(row, 1, row_size, file) == (size_t)row_size;
+    }
+
+    delete[] row;
+    return fclose(file) == 0 && written;
+}
@@ -7,14 +7,22 @@
 #include "SDLauxiliary.h"
 #include "omp.h"
 #include "../geometry/random.h"
+#include "../geometry/scratch.h"
+#include "tile_scheduler.h"
+#include "accumulator.h"
 #include <optional>
+#include <utility>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
 
 using std::optional;
+using std::pair;
+using std::unordered_map;
 
-// return: the color in the scene at the point where the ray intersects the scene.
-vec3 colour_in_scene(Scene &scene, Ray &ray, const int num_shadow_rays) {
-    optional<Intersection> i = scene.closest_intersection(ray);
-
+// param i: the closest intersection of the ray with the scene.
+// return: the color in the scene at the intersection.
+vec3 colour_at_intersection(Scene &scene, Ray &ray, const optional<Intersection> &i, const int num_shadow_rays) {
     if (!i.has_value()) {
         return vec3(0, 0, 0);
     }
@@ -22,33 +30,37 @@ vec3 colour_in_scene(Scene &scene, Ray &ray, const int num_shadow_rays) {
     vec3 acc_colour = vec3(0, 0, 0);
     // Colour is addative for all lights.
     for (const Light *light: scene.lights) {
-        acc_colour += i->primitive->shader->shadowed_color(i->pos, i->primitive, ray, scene, *light, num_shadow_rays);
+        acc_colour += i->primitive->shader->shadowed_color(i->pos, i->primitive, i->object, ray, scene, *light, num_shadow_rays);
     }
 
     return acc_colour;
 }
 
-// return: a vector containing a single target (x, y). Useful for testing.
-vector<vec2> single_target(int x, int y) {
-    vector<vec2> targets;
+// return: the color in the scene at the point where the ray intersects the scene.
+vec3 colour_in_scene(Scene &scene, Ray &ray, const int num_shadow_rays) {
+    optional<Intersection> i = scene.closest_intersection(ray);
+    return colour_at_intersection(scene, ray, i, num_shadow_rays);
+}
+
+// effect: adds a single target (x, y) to targets. Useful for testing.
+void single_target(int x, int y, vector<vec2> &targets) {
     targets.push_back(vec2(x, y));
-    return targets;
 }
 
-// return: a number of random points to sample for the pixel with center (x, y).
-vector<vec2> random_screen_targets(int x, int y, int num_rays) {
-    vector<vec2> targets;
+// effect: adds a number of random points to sample for the pixel with center
+//         (x, y) to targets.
+void random_screen_targets(int x, int y, int num_rays, vector<vec2> &targets) {
     for (int i=0; i<num_rays; i++) {
         vec2 pixel_center = vec2((float)x, (float)y);
         // We sample an area around the pixel too, hence the 1.5
         vec2 target = random_in_box(pixel_center, 0.02, 0.02);
         targets.push_back(target);
     }
-    return targets;
 }
 
-// return: a number of points in a grid to sample for the pixel with center (x, y).
-vector<vec2> grid_primary_rays(int x, int y, int num_rays) {
+// effect: adds a number of points in a grid to sample for the pixel with
+//         center (x, y) to targets.
+void grid_primary_rays(int x, int y, int num_rays, vector<vec2> &targets) {
     // num_rays = 4;
     //
     // float pixel_size = 5.0f; // Sample outside the pixel.
@@ -64,15 +76,12 @@ vector<vec2> grid_primary_rays(int x, int y, int num_rays) {
     //     }
     // }
 
-    vector<vec2> targets;
     float delta = 0.02f, step = 0.01f;
     for (float i=-delta; i<=delta; i+=step) {
         for (float j=-delta; j<=delta; j+=step) {
             targets.push_back(vec2(x + i, y + j));
         }
     }
-
-    return targets;
 }
 
 // return: fires a number of primary rays randomly into the pixel, and computes
@@ -83,27 +92,464 @@ vec3 mean_pixel_color(Scene &scene, Camera &camera, screen *screen, const int x,
         return colour_in_scene(scene, ray, num_shadow_rays);
     }
 
-    vector<vec2> targets = random_screen_targets(x, y, num_primary_rays);
-    //vector<vec2> targets = grid_primary_rays(x, y, num_primary_rays);
+    ScratchVector<vec2> targets;
+    random_screen_targets(x, y, num_primary_rays, *targets);
+    //grid_primary_rays(x, y, num_primary_rays, *targets);
 
     // Used to total up the color of all the pixels so it can be averaged.
     vec3 acc_color = vec3(0, 0, 0);
-    for (vec2 target: targets) {
+    for (vec2 target: *targets) {
         Ray ray = camera.primary_ray(target.x, target.y, screen->width, screen->height);
         acc_color += colour_in_scene(scene, ray, num_shadow_rays);
     }
-    return acc_color / (float)targets.size();
+    return acc_color / (float)targets->size();
+}
+
+// return: the scheduler used by render, which keeps how long each thread
+//         was busy for in the last frame.
+TileScheduler &render_scheduler() {
+    static TileScheduler scheduler;
+    return scheduler;
 }
 
-// effect: renders the scene to the screen buffer using the camera.
+// effect: renders the scene to the screen buffer using the camera. The
+//         screen is split into tiles which are shared out between the
+//         threads as they finish, as some parts of the scene, e.g. volumes,
+//         take far longer to render than others.
 // param num_samples: the number of primary rays to average per pixel.
 // param num_shadow_rays: the number of rays to shoot to the the sphere around the light.
 void render(Scene &scene, Camera &camera, screen* screen, const int num_samples, const int num_shadow_rays) {
-    #pragma omp parallel for
-    for (int y=0; y<screen->height; y++) {
-        for (int x=0; x<screen->width; x++) {
-            vec3 color = mean_pixel_color(scene, camera, screen, x, y, num_samples, num_shadow_rays);
-            PutPixelSDL(screen, x, y, color);
+    auto render_tile = [&](const Tile &tile) {
+        for (int y=tile.y0; y<tile.y1; y++) {
+            for (int x=tile.x0; x<tile.x1; x++) {
+                vec3 color = mean_pixel_color(scene, camera, screen, x, y, num_samples, num_shadow_rays);
+                PutPixelSDL(screen, x, y, color);
+            }
+        }
+    };
+
+    render_scheduler().render(screen->width, screen->height, render_tile);
+}
+
+// effect: renders the scene as render does, except the colour of each pixel
+//         is added to the accumulator and the mean of all the frames added
+//         so far is displayed. The first frame after a reset samples the
+//         centre of each pixel, as render does, and later frames jitter the
+//         primary rays within the pixel, so the edges are anti-aliased as
+//         well as the shadows and volumes being smoothed.
+// param num_samples: the number of primary rays to average per pixel each frame.
+// param num_shadow_rays: the number of rays to shoot to the the sphere around the light.
+void render_progressive(Scene &scene, Camera &camera, screen* screen, Accumulator &accumulator, const int num_samples, const int num_shadow_rays) {
+    const bool jitter = accumulator.frames() > 0;
+
+    auto render_tile = [&](const Tile &tile) {
+        for (int y=tile.y0; y<tile.y1; y++) {
+            for (int x=tile.x0; x<tile.x1; x++) {
+                vec3 color = vec3(0, 0, 0);
+                for (int i=0; i<num_samples; i++) {
+                    vec2 target = jitter ? random_in_box(vec2(x, y), 1.0f, 1.0f) : vec2(x, y);
+                    Ray ray = camera.primary_ray_at(target.x, target.y, screen->width, screen->height);
+                    color += colour_in_scene(scene, ray, num_shadow_rays);
+                }
+
+                color = accumulator.add(x, y, color / (float)num_samples);
+                PutPixelSDL(screen, x, y, color);
+            }
+        }
+    };
+
+    render_scheduler().render(screen->width, screen->height, render_tile);
+    accumulator.end_frame();
+}
+
+// param min_samples: the number of primary rays fired at every pixel, and
+//                    in each batch after, which must be at least two.
+// param max_samples: the most primary rays to fire at the pixel.
+// param max_error: the standard error of the mean colour, in each channel,
+//                  below which no more samples are taken.
+// param num_samples: set to the number of primary rays fired.
+// return: the mean colour of primary rays jittered across the pixel. Batches
+//         of rays are fired until the mean is estimated well enough, so
+//         flat areas take few rays, and noisy areas, e.g. soft shadows,
+//         volumes, and edges, take many.
+vec3 adaptive_pixel_color(Scene &scene, Camera &camera, screen *screen, const int x, const int y, int min_samples, int max_samples, float max_error, int num_shadow_rays, int &num_samples) {
+    // The running mean and sum of squared differences from the mean, as in
+    // Welford's algorithm, which is stable for pixels with little variance.
+    vec3 mean = vec3(0, 0, 0);
+    vec3 squared_diffs = vec3(0, 0, 0);
+    num_samples = 0;
+
+    while (num_samples < max_samples) {
+        const int batch_end = std::min(num_samples + min_samples, max_samples);
+        for (; num_samples<batch_end; num_samples++) {
+            vec2 target = random_in_box(vec2(x, y), 1.0f, 1.0f);
+            Ray ray = camera.primary_ray_at(target.x, target.y, screen->width, screen->height);
+            // Clamped as the screen is, so very bright samples, which will
+            // be displayed as white anyway, do not count as noise.
+            vec3 color = glm::clamp(colour_in_scene(scene, ray, num_shadow_rays), 0.0f, 1.0f);
+
+            vec3 delta = color - mean;
+            mean += delta / (float)(num_samples + 1);
+            squared_diffs += delta * (color - mean);
+        }
+
+        // The variance of the mean is the variance of the samples divided
+        // by the number of samples.
+        vec3 variance = squared_diffs / (float)(num_samples * (num_samples - 1));
+        float max_variance = std::max(variance.x, std::max(variance.y, variance.z));
+        if (max_variance <= max_error * max_error) {
+            break;
+        }
+    }
+
+    return mean;
+}
+
+// effect: renders the scene as render does, except each pixel takes as many
+//         samples as it needs, up to max_samples, as in adaptive_pixel_color.
+//         At least two samples are taken, as the error cannot be estimated
+//         from one.
+// return: the mean number of primary rays fired per pixel.
+float render_adaptive(Scene &scene, Camera &camera, screen* screen, const int min_samples, const int max_samples, const float max_error, const int num_shadow_rays) {
+    const int batch_samples = std::max(min_samples, 2);
+    const int most_samples = std::max(max_samples, batch_samples);
+    std::atomic<long> total_samples(0);
+
+    auto render_tile = [&](const Tile &tile) {
+        long tile_samples = 0;
+        for (int y=tile.y0; y<tile.y1; y++) {
+            for (int x=tile.x0; x<tile.x1; x++) {
+                int num_samples;
+                vec3 color = adaptive_pixel_color(scene, camera, screen, x, y, batch_samples, most_samples, max_error, num_shadow_rays, num_samples);
+                PutPixelSDL(screen, x, y, color);
+                tile_samples += num_samples;
+            }
+        }
+        total_samples += tile_samples;
+    };
+
+    render_scheduler().render(screen->width, screen->height, render_tile);
+    return (float)total_samples.load() / (screen->width * screen->height);
+}
+
+// A square of up to packet_width by packet_width pixels, whose primary rays
+// are traced together as a packet.
+struct PacketTile {
+    // The pixels covered, from (x0, y0) inclusive to (x1, y1) exclusive.
+    int x0, y0, x1, y1;
+
+    // param p: the index of the tile, counting along rows of tiles.
+    // param tiles_x: the number of tiles along each row.
+    PacketTile(const screen *screen, int p, int tiles_x) {
+        this->x0 = (p % tiles_x) * packet_width;
+        this->y0 = (p / tiles_x) * packet_width;
+        this->x1 = std::min(this->x0 + packet_width, screen->width);
+        this->y1 = std::min(this->y0 + packet_width, screen->height);
+    }
+
+    // return: the number of tiles needed to cover the screen along x and y.
+    static int num_tiles_x(const screen *screen) {
+        return (screen->width + packet_width - 1) / packet_width;
+    }
+
+    static int num_tiles_y(const screen *screen) {
+        return (screen->height + packet_width - 1) / packet_width;
+    }
+
+    // effect: adds the primary rays through the pixels in the tile, row by
+    //         row, to rays.
+    void primary_rays(Camera &camera, const screen *screen, vector<Ray> &rays) const {
+        for (int y=this->y0; y<this->y1; y++) {
+            for (int x=this->x0; x<this->x1; x++) {
+                rays.push_back(camera.primary_ray(x, y, screen->width, screen->height));
+            }
+        }
+    }
+
+    // return: the x and y coordinate of the pixel of the r'th ray.
+    int pixel_x(int r) const {
+        return this->x0 + r % (this->x1 - this->x0);
+    }
+
+    int pixel_y(int r) const {
+        return this->y0 + r / (this->x1 - this->x0);
+    }
+};
+
+// effect: renders the scene as render does with one sample per pixel, except
+//         the primary rays for each square of packet_width by packet_width
+//         pixels are traced together as a packet. This is faster as the
+//         rays in a packet are coherent, so visit the same nodes.
+// param num_shadow_rays: the number of rays to shoot to the the sphere around the light.
+void render_packets(Scene &scene, Camera &camera, screen* screen, const int num_shadow_rays) {
+    const int tiles_x = PacketTile::num_tiles_x(screen);
+    const int num_tiles = tiles_x * PacketTile::num_tiles_y(screen);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int p=0; p<num_tiles; p++) {
+        const PacketTile tile = PacketTile(screen, p, tiles_x);
+        ScratchVector<Ray> rays;
+        tile.primary_rays(camera, screen, *rays);
+
+        const RayPacket packet = RayPacket(rays->data(), rays->size());
+        optional<Intersection> intersections[packet_size];
+        scene.closest_intersections(packet, intersections);
+
+        for (int r=0; r<(int)rays->size(); r++) {
+            vec3 color = colour_at_intersection(scene, (*rays)[r], intersections[r], num_shadow_rays);
+            PutPixelSDL(screen, tile.pixel_x(r), tile.pixel_y(r), color);
+        }
+    }
+}
+
+// The maximum number of primary rays traced together by render_wavefront.
+// This is kept small enough for the intersections to still be in cache when
+// they are shaded.
+const int wavefront_size = 1 << 12;
+
+// param tile_offsets: the index of the first ray of each tile in the wavefront.
+// effect: writes black to the pixels of rays which did not hit anything, and
+//         fills hits and hit_shaders with the tile and ray index, and shader,
+//         of the rest. Hits with the same shader are next to each other.
+void group_hits_by_shader(screen *screen, int first_tile, int tiles_x, const vector<int> &tile_offsets, const vector<optional<Intersection>> &intersections, vector<pair<int, int>> &hits, vector<const Shader*> &hit_shaders) {
+    // The shaders hit, in the order they were first hit. These are kept
+    // between wavefronts, and frames, so finding the same shaders again does
+    // not allocate.
+    static thread_local unordered_map<const Shader*, int> shader_indices;
+    static thread_local vector<const Shader*> shaders;
+    // The number of hits with each shader.
+    ScratchVector<int> counts;
+    counts->assign(shaders.size(), 0);
+    // The index, in shaders, of the shader of each hit in ray order.
+    ScratchVector<int> ray_shaders;
+
+    // Neighbouring rays usually hit the same shader, so it is only looked up
+    // when it changes.
+    const Shader *last_shader = nullptr;
+    int last_index = 0;
+
+    const int num_tiles = tile_offsets.size() - 1;
+    for (int p=0; p<num_tiles; p++) {
+        const PacketTile tile = PacketTile(screen, first_tile + p, tiles_x);
+        for (int r=0; r<tile_offsets[p + 1] - tile_offsets[p]; r++) {
+            const optional<Intersection> &i = intersections[tile_offsets[p] + r];
+            if (!i.has_value()) {
+                PutPixelSDL(screen, tile.pixel_x(r), tile.pixel_y(r), vec3(0, 0, 0));
+                continue;
+            }
+
+            const Shader *shader = i->primitive->shader;
+            if (shader != last_shader) {
+                auto found = shader_indices.find(shader);
+                if (found == shader_indices.end()) {
+                    found = shader_indices.insert(std::make_pair(shader, (int)shaders.size())).first;
+                    shaders.push_back(shader);
+                    counts->push_back(0);
+                }
+                last_shader = shader;
+                last_index = found->second;
+            }
+
+            (*counts)[last_index]++;
+            ray_shaders->push_back(last_index);
+        }
+    }
+
+    // Where the hits with each shader start, as in a counting sort.
+    ScratchVector<int> offsets;
+    offsets->assign(shaders.size() + 1, 0);
+    for (size_t s=0; s<shaders.size(); s++) {
+        (*offsets)[s + 1] = (*offsets)[s] + (*counts)[s];
+    }
+
+    hits.resize(ray_shaders->size());
+    hit_shaders.resize(ray_shaders->size());
+
+    int ray_hit = 0;
+    for (int p=0; p<num_tiles; p++) {
+        for (int r=0; r<tile_offsets[p + 1] - tile_offsets[p]; r++) {
+            if (intersections[tile_offsets[p] + r].has_value()) {
+                const int s = (*ray_shaders)[ray_hit++];
+                const int h = (*offsets)[s]++;
+
+                hits[h] = std::make_pair(p, r);
+                hit_shaders[h] = shaders[s];
+            }
+        }
+    }
+}
+
+// param shade: called with the index of each item, and the vector to add
+//              the rays it spawns to.
+// effect: calls shade on each item in [0, num_items) in parallel, then adds
+//         the rays spawned by all the items to queued, in the order of the
+//         items, so the rays are traced in the same order each time.
+template<typename F>
+void queue_in_parallel(int num_items, vector<QueuedRay> &queued, F shade) {
+    #pragma omp parallel
+    {
+        ScratchVector<QueuedRay> thread_queued;
+
+        // Static scheduling gives each thread a contiguous run of items, in
+        // the order of the threads, and each thread a contiguous run of the
+        // thread numbers below.
+        #pragma omp for schedule(static)
+        for (int i=0; i<num_items; i++) {
+            shade(i, *thread_queued);
+        }
+
+        #pragma omp for ordered schedule(static, 1)
+        for (int t=0; t<omp_get_num_threads(); t++) {
+            #pragma omp ordered
+            queued.insert(queued.end(), thread_queued->begin(), thread_queued->end());
+        }
+    }
+}
+
+// param hit: the hit of the wavefront the ray adds colour to.
+// effect: sets the light and hit of the rays queued from first onwards,
+//         which were spawned while shading for the light.
+void set_queued_source(vector<QueuedRay> &queued, size_t first, const Light *light, int hit) {
+    for (size_t q=first; q<queued.size(); q++) {
+        queued[q].light = light;
+        queued[q].hit = hit;
+    }
+}
+
+// param colours: the colour of each hit of the wavefront.
+// effect: traces the queued rays, and any rays their shaders spawn in turn,
+//         one bounce at a time. At each bounce, all the rays are intersected
+//         with the scene, and the hits are shaded sorted by shader. The
+//         colour of each ray, multiplied by its weight, is added to the
+//         colour of its hit.
+void trace_queued_rays(const Scene &scene, vector<QueuedRay> &queued, vector<vec3> &colours, const int num_shadow_rays) {
+    while (!queued.empty()) {
+        const int num_queued = queued.size();
+
+        // The intersection of each queued ray. Unlike primary rays, these
+        // are not coherent, so are not traced as packets.
+        ScratchVector<optional<Intersection>> intersections;
+        intersections->resize(num_queued);
+
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (int q=0; q<num_queued; q++) {
+            optional<Intersection> i = scene.closest_intersection(queued[q].ray, queued[q].prim, queued[q].obj);
+            if (i.has_value()) {
+                (*intersections)[q].emplace(*i);
+            }
+        }
+
+        // The shader and index of each ray which hit something, sorted so
+        // the rays with the same shader are shaded together.
+        ScratchVector<pair<const Shader*, int>> order;
+        for (int q=0; q<num_queued; q++) {
+            if ((*intersections)[q].has_value()) {
+                order->push_back(std::make_pair((*intersections)[q]->primitive->shader, q));
+            }
+        }
+        std::sort(order->begin(), order->end());
+
+        // The colour of each ray. Several rays may add to the same hit, e.g.
+        // the reflection and refraction from glass, so these are added to
+        // the hits afterwards.
+        ScratchVector<vec3> ray_colours;
+        ray_colours->assign(num_queued, vec3(0, 0, 0));
+        // The rays spawned at this bounce.
+        ScratchVector<QueuedRay> next;
+
+        queue_in_parallel(order->size(), *next, [&](int k, vector<QueuedRay> &spawned) {
+            const int q = (*order)[k].second;
+            const QueuedRay &ray = queued[q];
+            const Intersection &i = *(*intersections)[q];
+
+            const size_t first = spawned.size();
+            (*order)[k].first->queue_color(i.pos, i.primitive, i.object, ray.ray, scene, *ray.light, num_shadow_rays, ray.weight, (*ray_colours)[q], spawned);
+            set_queued_source(spawned, first, ray.light, ray.hit);
+        });
+
+        for (int q=0; q<num_queued; q++) {
+            colours[queued[q].hit] += (*ray_colours)[q];
+        }
+
+        // Copied rather than swapped, so each buffer keeps the capacity it
+        // needs and later frames do not allocate.
+        queued.assign(next->begin(), next->end());
+    }
+}
+
+// effect: renders the scene as render_packets does, except the work is done
+//         breadth first. All the primary rays in a wavefront of tiles are
+//         intersected with the scene first. The hits are then sorted by
+//         shader, and each shader is run on all of its hits for one light at
+//         a time. This keeps the code and data for one shader and light in
+//         cache, rather than jumping between shaders at every pixel. Rays
+//         spawned by shaders which support queueing them, e.g. mirrors and
+//         glass, are then traced the same way, a bounce at a time. Other
+//         shaders still trace their rays when they are run.
+// param num_shadow_rays: the number of rays to shoot to the the sphere around the light.
+void render_wavefront(Scene &scene, Camera &camera, screen* screen, const int num_shadow_rays) {
+    const int tiles_x = PacketTile::num_tiles_x(screen);
+    const int num_tiles = tiles_x * PacketTile::num_tiles_y(screen);
+    const int tiles_per_wavefront = wavefront_size / packet_size;
+
+    for (int first_tile=0; first_tile<num_tiles; first_tile+=tiles_per_wavefront) {
+        const int wave_tiles = std::min(tiles_per_wavefront, num_tiles - first_tile);
+
+        // The rays of every tile in the wavefront, one tile after another,
+        // and the index of the first ray of each tile. Making the rays is
+        // cheap compared to intersecting them, so is done up front.
+        ScratchVector<Ray> rays;
+        ScratchVector<int> tile_offsets;
+        for (int p=0; p<wave_tiles; p++) {
+            tile_offsets->push_back(rays->size());
+            PacketTile(screen, first_tile + p, tiles_x).primary_rays(camera, screen, *rays);
+        }
+        tile_offsets->push_back(rays->size());
+
+        // The intersection of each ray.
+        ScratchVector<optional<Intersection>> intersections;
+        intersections->resize(rays->size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int p=0; p<wave_tiles; p++) {
+            const int first = (*tile_offsets)[p];
+            const RayPacket packet = RayPacket(&(*rays)[first], (*tile_offsets)[p + 1] - first);
+            scene.closest_intersections(packet, &(*intersections)[first]);
+        }
+
+        // The tile and ray in the tile of each hit, grouped by shader.
+        ScratchVector<pair<int, int>> hits;
+        ScratchVector<const Shader*> hit_shaders;
+        group_hits_by_shader(screen, first_tile, tiles_x, *tile_offsets, *intersections, *hits, *hit_shaders);
+
+        // The colour of each hit, added up over the lights in the same order
+        // as colour_at_intersection.
+        ScratchVector<vec3> colours;
+        colours->assign(hits->size(), vec3(0, 0, 0));
+        // The rays spawned by the shaders, traced once all the hits have
+        // been shaded.
+        ScratchVector<QueuedRay> queued;
+
+        for (const Light *light: scene.lights) {
+            // Each thread is given a contiguous run of hits, so mostly with
+            // the same shader.
+            queue_in_parallel(hits->size(), *queued, [&](int h, vector<QueuedRay> &spawned) {
+                const int ray_idx = (*tile_offsets)[(*hits)[h].first] + (*hits)[h].second;
+                const Ray &ray = (*rays)[ray_idx];
+                const Intersection &i = *(*intersections)[ray_idx];
+
+                const size_t first = spawned.size();
+                (*hit_shaders)[h]->queue_color(i.pos, i.primitive, i.object, ray, scene, *light, num_shadow_rays, vec3(1, 1, 1), (*colours)[h], spawned);
+                set_queued_source(spawned, first, light, h);
+            });
+        }
+
+        trace_queued_rays(scene, *queued, *colours, num_shadow_rays);
+
+        #pragma omp parallel for
+        for (int h=0; h<(int)hits->size(); h++) {
+            const PacketTile tile = PacketTile(screen, first_tile + (*hits)[h].first, tiles_x);
+            PutPixelSDL(screen, tile.pixel_x((*hits)[h].second), tile.pixel_y((*hits)[h].second), (*colours)[h]);
         }
     }
 }
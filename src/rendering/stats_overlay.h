@@ -0,0 +1,45 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include "SDLauxiliary.h"
+#include "../geometry/ray_stats.h"
+
+// The height in pixels of each bar drawn by draw_stats_overlay, and the
+// width of each factor of ten.
+const int overlay_bar_height = 4;
+const int overlay_decade_width = 16;
+
+// effect: draws a bar over the top left of the screen for each statistic,
+//         in the order of RayStat, then for the rays at each bounce depth.
+//         The bars are on a log scale, overlay_decade_width pixels for each
+//         factor of ten, so counts from one to billions fit on the screen.
+//         Rays are green, tests blue, march steps orange, and bounce depths
+//         grey.
+void draw_stats_overlay(screen *s, const FrameStats &stats) {
+    auto draw_bar = [&](int row, long count, uint32_t color) {
+        const int width = count > 0 ? (int)(overlay_decade_width * (log10((double)count) + 1.0)) : 0;
+        const int y0 = 2 + row * (overlay_bar_height + 2);
+
+        for (int y=y0; y<y0 + overlay_bar_height && y<s->height; y++) {
+            for (int x=2; x<2 + width && x<s->width; x++) {
+                s->buffer[y * s->width + x] = color;
+            }
+        }
+    };
+
+    int row = 0;
+    for (int stat=0; stat<num_ray_stats; stat++) {
+        uint32_t color = stat <= stat_volume_rays ? 0xff40e040
+                       : stat <= stat_other_tests ? 0xff4080ff
+                       : 0xffffa020;
+        draw_bar(row++, stats.counts[stat], color);
+    }
+
+    // Bounce depths are drawn from depth zero, i.e. the most bounces
+    // remaining, down to rays with no bounces remaining.
+    const int max_remaining = stats.depth(0);
+    for (int b=max_remaining; b>=0; b--) {
+        draw_bar(row++, stats.bounces[b], 0xffa0a0a0);
+    }
+}
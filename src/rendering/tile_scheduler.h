@@ -0,0 +1,275 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+#include <stdint.h>
+#include "omp.h"
+
+using std::vector;
+
+// The width and height, in pixels, of the tiles handed out by TileScheduler.
+const int tile_width = 16;
+
+// A square of up to tile_width by tile_width pixels.
+struct Tile {
+    // The pixels covered, from (x0, y0) inclusive to (x1, y1) exclusive.
+    int x0, y0, x1, y1;
+};
+
+// The tiles of one thread, which are taken from the front by that thread
+// and from the back by other threads once they run out. No tiles are added
+// once a frame has started, so the front and back are packed into one
+// atomic and updated together, rather than locking.
+class alignas(64) TileDeque {
+private:
+    // The front in the low 32 bits, the back in the high 32 bits.
+    std::atomic<uint64_t> range;
+
+public:
+    TileDeque(): range(0) {
+    }
+
+    // effect: sets the deque to hold the tiles from front, inclusive, to
+    //         back, exclusive.
+    void reset(int front, int back) {
+        this->range.store((uint64_t)front | ((uint64_t)back << 32), std::memory_order_relaxed);
+    }
+
+    // param tile: set to the tile taken, if there is one.
+    // return: whether a tile was taken from the front.
+    bool pop_front(int &tile) {
+        return this->take(true, tile);
+    }
+
+    // return: whether a tile was taken from the back.
+    bool steal_back(int &tile) {
+        return this->take(false, tile);
+    }
+
+    // return: the number of tiles left.
+    int size() const {
+        const uint64_t range = this->range.load(std::memory_order_relaxed);
+        return std::max((int)(range >> 32) - (int)(uint32_t)range, 0);
+    }
+
+private:
+    bool take(bool from_front, int &tile) {
+        uint64_t range = this->range.load(std::memory_order_relaxed);
+        while (true) {
+            const uint32_t front = (uint32_t)range;
+            const uint32_t back = (uint32_t)(range >> 32);
+            if (front >= back) {
+                return false;
+            }
+
+            const uint64_t taken = from_front ? (uint64_t)(front + 1) | ((uint64_t)back << 32)
+                                              : (uint64_t)front | ((uint64_t)(back - 1) << 32);
+            if (this->range.compare_exchange_weak(range, taken, std::memory_order_relaxed)) {
+                tile = from_front ? front : back - 1;
+                return true;
+            }
+        }
+    }
+};
+
+// How long one thread spent rendering tiles in the last frame.
+struct ThreadUtilisation {
+    // Time, in seconds, spent rendering tiles, and waiting for the other
+    // threads to finish the frame.
+    double busy, idle;
+    int tiles_rendered;
+    // The number of tiles taken from other threads.
+    int tiles_stolen;
+};
+
+// Splits the screen into tiles, and hands them out to the threads rendering
+// a frame. Each thread starts with a run of neighbouring tiles, in Morton
+// order so they cover a compact area of the screen and share rays through
+// the same parts of the scene. Threads which run out of tiles, e.g. because
+// theirs were quick to render, steal tiles from the back of other threads'
+// runs. Therefore expensive areas of the screen, e.g. volumes or glass, are
+// shared between all the threads, rather than left to whichever thread was
+// given them.
+class TileScheduler {
+private:
+    int width = 0, height = 0, tiles_x = 0;
+    // The index, counting along rows of tiles, of the tiles in Morton order.
+    vector<int> tile_order;
+    TileDeque *deques = nullptr;
+    int num_deques = 0;
+    // The utilisation of each thread in the last frame, and how long the
+    // frame took in seconds.
+    vector<ThreadUtilisation> utilisation;
+    double frame_time = 0.0;
+
+public:
+    TileScheduler() {
+    }
+
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler &operator=(const TileScheduler&) = delete;
+
+    ~TileScheduler() {
+        delete[] this->deques;
+    }
+
+    // param render_tile: called with each tile of the screen, from several
+    //                    threads at once.
+    // effect: renders every tile of a width by height screen, using all the
+    //         threads, and records how long each thread was busy for.
+    template<typename F>
+    void render(int width, int height, F render_tile) {
+        this->resize(width, height);
+
+        const int num_threads = omp_get_max_threads();
+        if (num_threads != this->num_deques) {
+            delete[] this->deques;
+            this->deques = new TileDeque[num_threads];
+            this->num_deques = num_threads;
+        }
+        this->utilisation.assign(num_threads, ThreadUtilisation{0.0, 0.0, 0, 0});
+
+        const double start = omp_get_wtime();
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            const int thread = omp_get_thread_num();
+            const int threads = omp_get_num_threads();
+            const int num_tiles = this->tile_order.size();
+            this->deques[thread].reset(num_tiles * thread / threads, num_tiles * (thread + 1) / threads);
+
+            #pragma omp barrier
+
+            ThreadUtilisation &used = this->utilisation[thread];
+            int position;
+            while (this->next_tile(thread, threads, position, used)) {
+                const double tile_start = omp_get_wtime();
+                render_tile(this->tile_at(this->tile_order[position]));
+                used.busy += omp_get_wtime() - tile_start;
+                used.tiles_rendered++;
+            }
+        }
+
+        this->frame_time = omp_get_wtime() - start;
+        for (ThreadUtilisation &used: this->utilisation) {
+            used.idle = this->frame_time - used.busy;
+        }
+    }
+
+    // return: the utilisation of each thread in the last frame rendered.
+    const vector<ThreadUtilisation> &thread_utilisation() const {
+        return this->utilisation;
+    }
+
+    // effect: writes a table of how long each thread was busy and idle for
+    //         in the last frame, and the proportion of the frame the threads
+    //         were busy for overall.
+    void report(std::ostream &out) const {
+        out << "thread   busy ms   idle ms  tiles  stolen" << std::endl;
+
+        double total_busy = 0.0;
+        for (size_t t=0; t<this->utilisation.size(); t++) {
+            const ThreadUtilisation &used = this->utilisation[t];
+            total_busy += used.busy;
+
+            out << std::setw(6) << t
+                << std::fixed << std::setprecision(2)
+                << std::setw(10) << 1000.0 * used.busy
+                << std::setw(10) << 1000.0 * used.idle
+                << std::setw(7) << used.tiles_rendered
+                << std::setw(8) << used.tiles_stolen << std::endl;
+        }
+
+        const double available = this->frame_time * this->utilisation.size();
+        out << "frame " << 1000.0 * this->frame_time << " ms, utilisation "
+            << (available > 0.0 ? 100.0 * total_busy / available : 0.0) << "%" << std::endl;
+    }
+
+private:
+    // effect: orders the tiles of a width by height screen, if the screen
+    //         has changed size.
+    void resize(int width, int height) {
+        if (width == this->width && height == this->height) {
+            return;
+        }
+
+        this->width = width;
+        this->height = height;
+        this->tiles_x = (width + tile_width - 1) / tile_width;
+        const int tiles_y = (height + tile_width - 1) / tile_width;
+
+        this->tile_order.resize(this->tiles_x * tiles_y);
+        for (size_t p=0; p<this->tile_order.size(); p++) {
+            this->tile_order[p] = p;
+        }
+
+        auto morton_code = [&](int p) {
+            return TileScheduler::interleave(p % this->tiles_x, p / this->tiles_x);
+        };
+        std::sort(this->tile_order.begin(), this->tile_order.end(), [&](int a, int b) {
+            return morton_code(a) < morton_code(b);
+        });
+    }
+
+    // param position: set to the position, in tile_order, of the next tile
+    //                 for the thread to render.
+    // return: whether there are any tiles left. The thread's own tiles are
+    //         rendered first, then tiles are stolen from the other threads.
+    bool next_tile(int thread, int threads, int &position, ThreadUtilisation &used) {
+        if (this->deques[thread].pop_front(position)) {
+            return true;
+        }
+
+        // Steal from the thread with the most tiles left, so the remaining
+        // work stays spread out. The sizes may change while looking, which
+        // only makes the choice less good.
+        while (true) {
+            int victim = -1, most_tiles = 0;
+            for (int i=1; i<threads; i++) {
+                const int other = (thread + i) % threads;
+                const int tiles = this->deques[other].size();
+                if (tiles > most_tiles) {
+                    victim = other;
+                    most_tiles = tiles;
+                }
+            }
+
+            if (victim == -1) {
+                return false;
+            }
+
+            if (this->deques[victim].steal_back(position)) {
+                used.tiles_stolen++;
+                return true;
+            }
+        }
+    }
+
+    // return: the pixels covered by the tile, counting along rows of tiles.
+    Tile tile_at(int p) const {
+        Tile tile;
+        tile.x0 = (p % this->tiles_x) * tile_width;
+        tile.y0 = (p / this->tiles_x) * tile_width;
+        tile.x1 = std::min(tile.x0 + tile_width, this->width);
+        tile.y1 = std::min(tile.y0 + tile_width, this->height);
+        return tile;
+    }
+
+    // return: the Morton code of (x, y), i.e. their bits interleaved.
+    static uint32_t interleave(uint32_t x, uint32_t y) {
+        return TileScheduler::spread_bits(x) | (TileScheduler::spread_bits(y) << 1);
+    }
+
+    // return: the lower 16 bits of v, with a zero between each.
+    static uint32_t spread_bits(uint32_t v) {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+};
@@ -13,18 +13,18 @@ public:
     }
 
     // return: the color of the intersected surface, as illuminated by a specific light.
-    vec3 specular_color(vec4 position, const Primitive *prim, const vec4 shadow_ray_dir, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+    vec3 specular_color(vec4 position, const Primitive *prim, const Object *obj, const vec4 shadow_ray_dir, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
         // Calculate attenuated light intensity at point
         vec3 intensity = light.intensity(position);
 
         // Calculate reflection ray direction
         vec3 l = normalize(vec3(shadow_ray_dir));
-        vec3 v = vec3(-incoming.normalized_dir);
+        vec3 v = -incoming.normalized_dir();
         vec3 lplusv = l + v;
         vec3 h = normalize(lplusv);
 
         //Calculate component of h in the direction of the primitive normal
-        vec4 surface_normal = prim->normal_at(position);
+        vec4 surface_normal = obj->normal_at(prim, position);
         float specular_highlight = dot(h, vec3(surface_normal));
         float new_specular_highlight = glm::pow(specular_highlight, specular_exponent);
 
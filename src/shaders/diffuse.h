@@ -17,8 +17,13 @@ public:
     }
 
     // return: the color of the intersected surface, as illuminated by a specific light.
-    vec3 color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
-        vec4 normal = prim->normal_at(position);
+    vec3 color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+        vec4 normal = obj->normal_at(prim, position);
         return light.projection_factor(position, normal) * light.intensity(position) * this->base_color;
     }
+
+    // return: true, as light cannot pass through a diffuse surface.
+    bool is_opaque() const override {
+        return true;
+    }
 };
@@ -14,11 +14,15 @@ public:
 
     // return: the base color of the surface irrespective of lighting or whether
     //         other objects are occluding the light.
-    vec3 shadowed_color(const vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+    vec3 shadowed_color(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
         return this->base_color;
     }
 
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const {
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const {
         return this->alpha;
     }
+
+    bool is_opaque() const override {
+        return this->alpha == 0.0f;
+    }
 };
@@ -21,10 +21,11 @@ public:
         s1(s1), s2(s2), ray_velocity_ratio(ray_velocity_ratio), base_transparency(base_transparency) {
     }
 
-    // return: the color of the intersected surface, as illuminated by a specific light.
-    vec3 shadowed_color(const vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
-        vec3 normal_3d = normalize(vec3(prim->normal_at(position)));
-        vec3 incoming_3d = vec3(incoming.normalized_dir);
+    // return: the proportion of s2 shown, i.e. the proportion of light
+    //         reflected by the surface.
+    float reflectance(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming) const {
+        vec3 normal_3d = normalize(vec3(obj->normal_at(prim, position)));
+        vec3 incoming_3d = incoming.normalized_dir();
 
         // From Scratch a Pixel:
         float cosi = glm::clamp(-1.0f, 1.0f, dot(normal_3d, incoming_3d));
@@ -46,13 +47,33 @@ public:
             kr = (Rs * Rs + Rp * Rp) / 2;
         }
 
-        vec3 color1 = this->s1->shadowed_color(position, prim, incoming, scene, light, num_shadow_rays);
-        vec3 color2 = this->s2->shadowed_color(position, prim, incoming, scene, light, num_shadow_rays);
+        return kr;
+    }
+
+    // return: the color of the intersected surface, as illuminated by a specific light.
+    vec3 shadowed_color(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+        float kr = this->reflectance(position, prim, obj, incoming);
+
+        vec3 color1 = this->s1->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
+        vec3 color2 = this->s2->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
 
         return mix(color1, color2, kr);
     }
 
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const override {
+    // effect: queues the rays of both shaders, weighted as shadowed_color
+    //         mixes them.
+    void queue_color(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays, vec3 weight, vec3 &color, vector<QueuedRay> &queued) const override {
+        float kr = this->reflectance(position, prim, obj, incoming);
+
+        this->s1->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, (1.0f - kr) * weight, color, queued);
+        this->s2->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, kr * weight, color, queued);
+    }
+
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const override {
         return this->base_transparency;
     }
+
+    bool is_opaque() const override {
+        return this->base_transparency == 0.0f;
+    }
 };
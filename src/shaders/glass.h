@@ -47,11 +47,15 @@ public:
 
     // return: the color of the intersected surface, taking shadows from the
     //         light into account.
-    vec3 shadowed_color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
-        return this->glass_shader->shadowed_color(position, prim, incoming, scene, light, num_shadow_rays);
+    vec3 shadowed_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+        return this->glass_shader->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
     }
 
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const override {
+    void queue_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays, vec3 weight, vec3 &color, vector<QueuedRay> &queued) const override {
+        this->glass_shader->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, weight, color, queued);
+    }
+
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const override {
         return 0.7f;
     }
 };
@@ -16,7 +16,7 @@ public:
 
 private:
     static ConvertDistToColor bent_ray_color(float strength, float black_out_angle) {
-        auto bent_ray = [=](float closest_dist, vec4 projection, vec4 diff, vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) {
+        auto bent_ray = [=](float closest_dist, vec4 projection, vec4 diff, vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) {
             // The angle to deflect the ray towards the center of the lens.
             float angle = strength / (closest_dist * closest_dist);
             float clamped_angle = glm::clamp(angle, 0.0f, (float)M_PI);
@@ -25,17 +25,18 @@ private:
                 return vec3(0,0,0);
             }
 
-            vec3 outgoing_dir_3d = deflected(vec3(incoming.dir), clamped_angle, vec3(projection), vec3(diff));
-            vec4 outgoing_dir = project_to_4D(outgoing_dir_3d);
+            vec3 outgoing_dir = deflected(incoming.dir, clamped_angle, vec3(projection), vec3(diff));
             // The number of bounces is reduced due to this interaction.
-            Ray outgoing_ray = Ray(position, outgoing_dir, incoming.bounces_remaining - 1);
+            Ray outgoing_ray = Ray(vec3(position), outgoing_dir, incoming.bounces_remaining - 1);
+            COUNT_RAY_STAT(stat_refraction_rays, 1);
+            COUNT_BOUNCE(outgoing_ray.bounces_remaining);
 
-            optional<Intersection> i = scene.closest_intersection(outgoing_ray, prim);
+            optional<Intersection> i = scene.closest_intersection(outgoing_ray, prim, obj);
             if (!i.has_value()) {
                 return vec3(0, 0, 0);
             }
 
-            return i->primitive->shader->shadowed_color(i->pos, i->primitive, outgoing_ray, scene, light, num_shadow_rays);
+            return i->primitive->shader->shadowed_color(i->pos, i->primitive, i->object, outgoing_ray, scene, light, num_shadow_rays);
         };
 
         return bent_ray;
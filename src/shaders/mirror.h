@@ -9,9 +9,18 @@ using glm::dot;
 class Mirror: public RaySpawner {
 public:
     // return: the direction of the reflected incoming ray.
-    virtual vec4 outgoing_ray_dir(const vec4 position, const Primitive *prim, const Ray &incoming) const override {
-        vec4 incident_ray = -incoming.dir;
-        vec4 normal = prim->normal_at(position);
+    virtual vec3 outgoing_ray_dir(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming) const override {
+        vec3 incident_ray = -incoming.dir;
+        vec3 normal = vec3(obj->normal_at(prim, position));
         return 2.0f * dot(incident_ray, normal) * normal - incident_ray;
     }
+
+    RayStat outgoing_ray_stat() const override {
+        return stat_reflection_rays;
+    }
+
+    // return: true, as all light hitting a mirror is reflected.
+    bool is_opaque() const override {
+        return true;
+    }
 };
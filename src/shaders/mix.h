@@ -5,33 +5,83 @@
 
 using std::function;
 
+// How a Mix combines the colors of its shaders, if it is one of the ways the
+// convenience functions make. Rays spawned by the shaders can then be queued
+// with the weight they add to the mix.
+enum MixKind {
+    mix_ratio,
+    mix_multiply,
+    mix_add,
+    // Any other combination, which is only combined once both colors are known.
+    mix_other
+};
+
 // Mixes two shaders together with a given operation.
 class Mix: public Shader {
 public:
     const Shader *s1;
     const Shader *s2;
     const function<vec3(vec3, vec3)> combine_colors;
+    const MixKind kind;
+    // The proportion s2 recieves, if mixed by ratio.
+    const float proportion;
 
-    Mix(const Shader *s1, const Shader *s2, function<vec3(vec3, vec3)> combine_colors):
-        s1(s1), s2(s2), combine_colors(combine_colors)
+private:
+    // Whether the mix of transparencies is always zero. Computed once as
+    // is_opaque is called for every shadow ray intersection.
+    const bool opaque;
+
+public:
+    Mix(const Shader *s1, const Shader *s2, function<vec3(vec3, vec3)> combine_colors, MixKind kind = mix_other, float proportion = 0.0f):
+        s1(s1), s2(s2), combine_colors(combine_colors), kind(kind), proportion(proportion),
+        opaque(s1->is_opaque() && s2->is_opaque() && combine_colors(vec3(0.0f), vec3(0.0f)).x == 0.0f)
     {
     }
 
     // return: the color of the intersected surface, as illuminated by a specific light.
-    vec3 shadowed_color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
-        vec3 color1 = this->s1->shadowed_color(position, prim, incoming, scene, light, num_shadow_rays);
-        vec3 color2 = this->s2->shadowed_color(position, prim, incoming, scene, light, num_shadow_rays);
+    vec3 shadowed_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+        vec3 color1 = this->s1->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
+        vec3 color2 = this->s2->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
 
         return this->combine_colors(color1, color2);
     }
 
+    // effect: queues the rays of both shaders, weighted by how much each
+    //         adds to the mix. For a multiply, the color of s2 is found
+    //         first, as it scales the colors where the rays of s1 hit.
+    void queue_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays, vec3 weight, vec3 &color, vector<QueuedRay> &queued) const override {
+        switch (this->kind) {
+            case mix_ratio:
+                this->s1->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, (1.0f - this->proportion) * weight, color, queued);
+                this->s2->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, this->proportion * weight, color, queued);
+                break;
+            case mix_multiply: {
+                const vec3 color2 = this->s2->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
+                this->s1->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, color2 * weight, color, queued);
+                break;
+            }
+            case mix_add:
+                this->s1->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, weight, color, queued);
+                this->s2->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, weight, color, queued);
+                break;
+            default:
+                Shader::queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, weight, color, queued);
+        }
+    }
+
     // return: the opacity of each shader mixed in the specified proportion.
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const override {
-        float a = s1->transparency(position, prim, shadow_ray, scene);
-        float b = s2->transparency(position, prim, shadow_ray, scene);
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const override {
+        float a = s1->transparency(position, prim, obj, shadow_ray, scene);
+        float b = s2->transparency(position, prim, obj, shadow_ray, scene);
         return this->combine_colors(vec3(a), vec3(b)).x;
     }
 
+    // return: whether both shaders are opaque, and mixing their
+    //         transparencies keeps them opaque.
+    bool is_opaque() const override {
+        return this->opaque;
+    }
+
     /*
      ** Convenience functions for creating mix shaders using different functions.
      */
@@ -43,7 +93,7 @@ public:
         auto combine_colors = [=](vec3 col1, vec3 col2) {
             return glm::mix(col1, col2, proportion);
         };
-        return new Mix(s1, s2, combine_colors);
+        return new Mix(s1, s2, combine_colors, mix_ratio, proportion);
     }
 
     // return: a shader that multiplies both shaders together.
@@ -51,7 +101,7 @@ public:
         auto combine_colors = [=](vec3 col1, vec3 col2) {
             return col1 * col2;
         };
-        return new Mix(s1, s2, combine_colors);
+        return new Mix(s1, s2, combine_colors, mix_multiply);
     }
 
     // return: a shader that adds both shaders together.
@@ -59,6 +109,6 @@ public:
         auto combine_colors = [=](vec3 col1, vec3 col2) {
             return col1 + col2;
         };
-        return new Mix(s1, s2, combine_colors);
+        return new Mix(s1, s2, combine_colors, mix_add);
     }
 };
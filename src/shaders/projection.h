@@ -90,10 +90,10 @@ public:
 
     // return: the color of the intersected surface, illuminated by a specular
     //         light, i.e. a directional light, point light, etc.
-    vec3 color(const vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec3 color(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         // Convert the position u,v coordinate (i.e. in the object's coordinate
         // space for planar mapping).
-        vec4 proj = prim->parent_obj->converted_world_to_obj(position);
+        vec4 proj = obj->converted_world_to_obj(position);
         // uv is in the range 0-1.
         vec2 uv = this->project_to_uv(proj);
         // Converts uv to be in image coordinates.
@@ -102,24 +102,30 @@ public:
 
     // param position: the position of the intersection of the prim with the shadow ray.
     // param prim: the primitive to calculate the transparency of.
+    // param obj: the object the primitive is part of.
     // param shadow_ray: the shadow ray from the original object the shadow is
     //                   being tested for, to the light source.
     // return: the proportion by which light is let through the
     //         material. E.g. a value of 1 is totally transparent, and a value
     //         of 0 is totally opaque.
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const {
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const {
         if (!use_red_as_alpha) {
             return 0.0f;
         }
         // Convert the position u,v coordinate (i.e. in the object's coordinate
         // space for planar mapping).
-        vec4 proj = prim->parent_obj->converted_world_to_obj(position);
+        vec4 proj = obj->converted_world_to_obj(position);
         // uv is in the range 0-1.
         vec2 uv = this->project_to_uv(proj);
         // Converts uv to be in image coordinates.
         return this->texture->color_at(uv).x;
     }
 
+    // return: whether the texture is not used as the transparency.
+    bool is_opaque() const override {
+        return !this->use_red_as_alpha;
+    }
+
     /*
      ** Convenience functions for creating shaders with different
      ** projection methods.
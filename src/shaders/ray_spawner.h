@@ -6,32 +6,55 @@ using std::optional;
 
 // Models a surface who's color is found by firing out another ray, e.g. mirror.
 class RaySpawner: public ShadowedShader {
+    // return: the type of ray fired, e.g. reflection for a mirror, which is
+    //         only used to count the rays.
+    virtual RayStat outgoing_ray_stat() const = 0;
+
     // return: the ray direction used to find the color of the shader, e.g. the
     //         reflected ray for a mirror.
-    virtual vec4 outgoing_ray_dir(const vec4 position, const Primitive *prim, const Ray &incoming) const = 0;
+    virtual vec3 outgoing_ray_dir(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming) const = 0;
+
+    // return: the ray fired from the surface, which the incoming ray must be
+    //         able to bounce to make.
+    Ray outgoing_ray(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming) const {
+        vec3 outgoing_dir = this->outgoing_ray_dir(position, prim, obj, incoming);
+        // The number of bounces is reduced due to this interaction.
+        Ray outgoing_ray = Ray(vec3(position), outgoing_dir, incoming.bounces_remaining - 1);
+        COUNT_RAY_STAT(this->outgoing_ray_stat(), 1);
+        COUNT_BOUNCE(outgoing_ray.bounces_remaining);
+        return outgoing_ray;
+    }
 
     // return: the color of the shader, determined by shooting another ray into
     //         the scene. Or, black if the incoming ray cannot bounce anymore.
-    vec3 color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec3 color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         if (!incoming.can_bounce()) {
             return vec3(0, 0, 0);
         }
 
-        vec4 outgoing_dir = this->outgoing_ray_dir(position, prim, incoming);
-        // The number of bounces is reduced due to this interaction.
-        Ray outgoing_ray = Ray(position, outgoing_dir, incoming.bounces_remaining - 1);
-
-        optional<Intersection> i = scene.closest_intersection(outgoing_ray, prim);
+        const Ray outgoing_ray = this->outgoing_ray(position, prim, obj, incoming);
+        optional<Intersection> i = scene.closest_intersection(outgoing_ray, prim, obj);
         if (!i.has_value()) {
             return vec3(0, 0, 0);
         }
 
-        return i->primitive->shader->shadowed_color(i->pos, i->primitive, outgoing_ray, scene, light, num_shadow_rays);
+        return i->primitive->shader->shadowed_color(i->pos, i->primitive, i->object, outgoing_ray, scene, light, num_shadow_rays);
+    }
+
+    // effect: queues the outgoing ray, weighted by how much of the light
+    //         reaches the surface, as color does.
+    void queue_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays, vec3 weight, vec3 &color, vector<QueuedRay> &queued) const override {
+        if (!incoming.can_bounce()) {
+            return;
+        }
+
+        const float transparency = mean_random_transparency(position, prim, obj, scene, light, num_shadow_rays);
+        queued.push_back(QueuedRay(this->outgoing_ray(position, prim, obj, incoming), prim, obj, transparency * weight));
     }
 
     // return: the color of the object in ambient lighting conditions, i.e.
     //         with no shadows.
-    vec3 ambient_color(vec4 position, const Primitive *prim, const Light &light) const {
+    vec3 ambient_color(vec4 position, const Primitive *prim, const Object *obj, const Light &light) const {
         return vec3(0, 0, 0);
     }
 };
@@ -21,11 +21,11 @@ public:
     }
 
     // return: the direction of the refracted incoming ray.
-    vec4 outgoing_ray_dir(const vec4 position, const Primitive *prim, const Ray &incoming) const override {
+    vec3 outgoing_ray_dir(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming) const override {
         float refraction_index = this->ray_velocity_ratio;
 
-        vec3 normal_3d = normalize(vec3(prim->normal_at(position)));
-        vec3 incoming_3d = vec3(incoming.normalized_dir);
+        vec3 normal_3d = normalize(vec3(obj->normal_at(prim, position)));
+        vec3 incoming_3d = incoming.normalized_dir();
 
         // cos(theta_1) = -(N . i)
         float a = -dot(normal_3d, incoming_3d);
@@ -54,11 +54,15 @@ public:
         // rI + N * ((r * cos(Θ)) - (sqrt(1 - r^2 * (1 - cos(Θ)^2))))
         vec3 g = refraction_index * incoming_3d + f;
 
-        return project_to_4D(g);
+        return g;
+    }
+
+    RayStat outgoing_ray_stat() const override {
+        return stat_refraction_rays;
     }
 
     // return: 1.0 as all light is allowed to pass through.
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const override {
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const override {
         return 1.0f;
     }
 };
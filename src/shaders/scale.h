@@ -18,8 +18,21 @@ public:
 
     // return: the color of the intersected surface, as illuminated by a
     //         specific light.
-    vec3 shadowed_color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
-        vec3 t = this->shader->shadowed_color(position, prim, incoming, scene, light, num_shadow_rays);
+    vec3 shadowed_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+        vec3 t = this->shader->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
         return glm::mix(this->min_col, this->max_col, t);
     }
+
+    // effect: adds the minimum color, and queues the rays of the shader
+    //         weighted by the range of colors, which is the same as
+    //         shadowed_color as the scaling is linear.
+    void queue_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays, vec3 weight, vec3 &color, vector<QueuedRay> &queued) const override {
+        color += weight * this->min_col;
+        this->shader->queue_color(position, prim, obj, incoming, scene, light, num_shadow_rays, (this->max_col - this->min_col) * weight, color, queued);
+    }
+
+    // return: true, as the transparency of the scaled shader is not used.
+    bool is_opaque() const override {
+        return true;
+    }
 };
@@ -1,11 +1,37 @@
 #pragma once
 
+#include <algorithm>
+#include <utility>
 #include "../geometry/scene.h"
+#include "../geometry/scratch.h"
 #include "../lights/light.h"
 
+using std::pair;
+
+// A ray spawned by a shader, e.g. a reflection, which is traced later by
+// render_wavefront rather than when the shader is run.
+struct QueuedRay {
+    Ray ray;
+    // The primitive the ray starts on, and its object, which the ray is not
+    // intersected with.
+    const Primitive *prim;
+    const Object *obj;
+    // How much the colour where the ray hits adds to the colour of the shader.
+    vec3 weight;
+    // The light the colour is for, and the hit of the wavefront the colour
+    // is added to. These are set by render_wavefront.
+    const Light *light;
+    int hit;
+
+    QueuedRay(const Ray &ray, const Primitive *prim, const Object *obj, vec3 weight):
+        ray(ray), prim(prim), obj(obj), weight(weight), light(nullptr), hit(-1)
+    {
+    }
+};
+
 // return: the mean transparency from the intersection position to the
 //         random points in the sphere of the light source.
-float mean_random_transparency(vec4 pos, const Primitive *prim, const Scene &scene, const Light &light, const int num_shadow_rays);
+float mean_random_transparency(vec4 pos, const Primitive *prim, const Object *obj, const Scene &scene, const Light &light, const int num_shadow_rays);
 
 // Used to model different types of surfaces, e.g. matte, glossy, etc.
 class Shader {
@@ -15,18 +41,37 @@ public:
 
     // param position: the position of the intersection of the prim with the shadow ray.
     // param prim: the primitive to calculate the transparency of.
+    // param obj: the object the primitive is part of.
     // param shadow_ray: the shadow ray from the original object the shadow is
     //                   being tested for, to the light source.
     // return: the proportion by which light is let through the
     //         material. E.g. a value of 1 is totally transparent, and a value
     //         of 0 is totally opaque.
-    virtual float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const {
+    virtual float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const {
         return 0.0f;
     }
 
+    // return: whether the shader is always totally opaque, i.e. transparency
+    //         always returns 0. Shadow rays stop as soon as they hit an opaque
+    //         primitive, without calling transparency on anything else along
+    //         the ray.
+    virtual bool is_opaque() const {
+        return false;
+    }
+
     // return: the color of the intersected surface. Takes occulsion of the
     //         light, by other objects, into account.
-    virtual vec3 shadowed_color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const = 0;
+    virtual vec3 shadowed_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const = 0;
+
+    // param weight: how much the colour of the shader adds to the final colour.
+    // effect: adds the shadowed color, multiplied by weight, to color, except
+    //         the rays the shader would trace, e.g. reflections, are added to
+    //         queued instead, with the weight of the colour where they hit.
+    //         Shaders which do not spawn rays, or whose colour does not
+    //         depend linearly on what spawned rays hit, trace them as usual.
+    virtual void queue_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays, vec3 weight, vec3 &color, vector<QueuedRay> &queued) const {
+        color += weight * this->shadowed_color(position, prim, obj, incoming, scene, light, num_shadow_rays);
+    }
 };
 
 // By subclassing this shader, a the materical can have its shadowed color
@@ -36,38 +81,64 @@ class ShadowedShader: public Shader {
 public:
     // return: the unshadowed color of the object. This is used to compute the
     //         shadowed color.
-    virtual vec3 color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const = 0;
+    virtual vec3 color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const = 0;
 
     // return: the color of the intersected surface. Takes occulsion of the
     //         light, by other objects, into account.
-    virtual vec3 shadowed_color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    virtual vec3 shadowed_color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         // How much the light ray penetrates to the light source.
         // This is higher if it travels through transparent objects.
-        float acc_transparency = mean_random_transparency(position, prim, scene, light, num_shadow_rays);
+        float acc_transparency = mean_random_transparency(position, prim, obj, scene, light, num_shadow_rays);
 
-        const vec3 col = this->color(position, prim, incoming, scene, light, num_shadow_rays);
+        const vec3 col = this->color(position, prim, obj, incoming, scene, light, num_shadow_rays);
         return acc_transparency * col;
     }
 };
 
 // return: the how much a light ray penetrates from an intersection to
 //         the light source.
-float shadow_ray_transparency(vec4 pos, const Primitive *prim, const Scene &scene, const Ray &shadow_ray) {
-    const float shadow_len = length(shadow_ray.dir);
+float shadow_ray_transparency(vec4 pos, const Primitive *prim, const Object *obj, const Scene &scene, const Ray &shadow_ray) {
+    // Whether an opaque object is between this object and the light, in
+    // which case no light gets through.
+    bool is_occluded = false;
+    // The non-opaque objects between this object and the light. Their
+    // transparency is only computed if nothing opaque is found, since it
+    // can be expensive, e.g. ray marching through volumes.
+    ScratchVector<Intersection> translucent_intersections;
+    // The distance along the shadow ray to each translucent intersection,
+    // paired with its index in translucent_intersections.
+    ScratchVector<pair<float, size_t>> translucent_order;
+
+    auto check_occluder = [&](const Intersection &intersection) {
+        if (intersection.primitive->shader->is_opaque()) {
+            is_occluded = true;
+            return false;
+        }
+        translucent_order->push_back(std::make_pair(intersection.t, translucent_intersections->size()));
+        translucent_intersections->push_back(intersection);
+        return true;
+    };
+
+    // Only intersections between this object and the light are considered,
+    // ignoring the primitive itself. Shadow rays end at the light.
+    scene.for_each_intersection(shadow_ray, prim, obj, check_occluder);
+
+    if (is_occluded) {
+        return 0.0f;
+    }
+
+    // Visit the intersections front-to-back, so once almost no light gets
+    // through, the transparency of objects hidden behind is not computed.
+    std::sort(translucent_order->begin(), translucent_order->end());
 
-    // The opacity of all objects on the way to the light determines
-    // how much light gets through to this object, ignoring the primitive.
-    vector<Intersection> all_intersections = scene.all_intersections(shadow_ray, prim);
     // The multiplication of all transparencies of all objects (before
     // the light) along the ray.
     float acc_mult_transparency = 1.0f;
 
-    for (size_t i=0; i<all_intersections.size() && acc_mult_transparency >= 0.001; i++) {
-        // If the intersection occurs between the light and this object.
-        if (length(all_intersections[i].pos - shadow_ray.start) < shadow_len) {
-            const Primitive *prim = all_intersections[i].primitive;
-            acc_mult_transparency *= prim->shader->transparency(all_intersections[i].pos, prim, shadow_ray, scene);
-        }
+    for (size_t i=0; i<translucent_order->size() && acc_mult_transparency >= 0.001; i++) {
+        const Intersection &intersection = (*translucent_intersections)[(*translucent_order)[i].second];
+        const Primitive *prim = intersection.primitive;
+        acc_mult_transparency *= prim->shader->transparency(intersection.pos, prim, intersection.object, shadow_ray, scene);
     }
 
     return acc_mult_transparency;
@@ -76,26 +147,27 @@ float shadow_ray_transparency(vec4 pos, const Primitive *prim, const Scene &scen
 // return: the mean transparency from the intersection position to the
 //         random points in the sphere of the light source. Accounts for if
 //         the light cannot cast shadows.
-float mean_random_transparency(vec4 pos, const Primitive *prim, const Scene &scene, const Light &light, const int num_shadow_rays) {
+float mean_random_transparency(vec4 pos, const Primitive *prim, const Object *obj, const Scene &scene, const Light &light, const int num_shadow_rays) {
     if (num_shadow_rays == 0) {
         return 1.0f;
     }
 
-    vector<Ray> shadow_rays = light.random_shadow_rays_from(pos, num_shadow_rays);
+    ScratchVector<Ray> shadow_rays;
+    light.random_shadow_rays_from(pos, num_shadow_rays, *shadow_rays);
 
     // If the light does not support shadows, assume all the light reached
     // the surface.
-    if (shadow_rays.size() == 0) {
+    if (shadow_rays->size() == 0) {
         return 1.0;
     }
 
     // The addition of all transparencies of the different shadow rays.
     float acc_add_transparency = 0.0f;
 
-    for (Ray shadow_ray: shadow_rays) {
-        acc_add_transparency += shadow_ray_transparency(pos, prim, scene, shadow_ray);
+    for (const Ray &shadow_ray: *shadow_rays) {
+        acc_add_transparency += shadow_ray_transparency(pos, prim, obj, scene, shadow_ray);
     }
 
     // Calculate the mean by dividing by the number of rays.
-    return acc_add_transparency / shadow_rays.size();
+    return acc_add_transparency / shadow_rays->size();
 }
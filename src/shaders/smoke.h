@@ -4,6 +4,7 @@
 #include <math.h>
 #include <functional>
 #include <optional>
+#include <stdexcept>
 
 using glm::mix;
 using glm::clamp;
@@ -23,22 +24,27 @@ public:
 
     // return: a color depending on how far the ray has to travel before
     //         exiting the smoke.
-    vec3 color(const vec4 position, const Primitive *smoke_prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec3 color(const vec4 position, const Primitive *smoke_prim, const Object *smoke_obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         // Offset into the shape as the excluded primitive on scene.closest_intersection
         // cannot be used here. This is because the smoke may be made of one
         // primitive (e.g. sphere) and we need to check for self-intersections.
-        Ray outgoing = Ray(position, incoming.dir, incoming.bounces_remaining - 1)
-                      .offset(smoke_prim->normal_at(position), -0.001);
+        Ray outgoing = Ray(vec3(position), incoming.dir, incoming.bounces_remaining - 1)
+                      .offset(vec3(smoke_obj->normal_at(smoke_prim, position)), -0.001);
+
+        // The ray is traced to the object behind the smoke, and to where it
+        // leaves the smoke.
+        COUNT_RAY_STAT(stat_volume_rays, 2);
+        COUNT_BOUNCE(outgoing.bounces_remaining);
 
         // The object behind the smoke.
-        optional<Intersection> behind_obj_i = scene.closest_intersection_excluding_obj(outgoing, smoke_prim->parent_obj);
+        optional<Intersection> behind_obj_i = scene.closest_intersection_excluding_obj(outgoing, smoke_obj);
 
         // The color of the object behind the smoke, or black if there is no
         // object behind.
         float dist_to_obj = std::numeric_limits<float>::max();
         vec3 behind_obj_col = vec3(0, 0, 0);
         if (behind_obj_i) {
-            behind_obj_col = behind_obj_i->primitive->shader->shadowed_color(behind_obj_i->pos, behind_obj_i->primitive, outgoing, scene, light, num_shadow_rays);
+            behind_obj_col = behind_obj_i->primitive->shader->shadowed_color(behind_obj_i->pos, behind_obj_i->primitive, behind_obj_i->object, outgoing, scene, light, num_shadow_rays);
             dist_to_obj = length(behind_obj_i->pos - position);
         }
 
@@ -46,7 +52,7 @@ public:
         // smoke the ray had to travel through.
 
         // The maximum distance the ray can travel in the smoke.
-        float max_smoke_dist = this->max_distance_in_smoke(position, smoke_prim->parent_obj, outgoing, scene);
+        float max_smoke_dist = this->max_distance_in_smoke(position, smoke_obj, outgoing, scene);
         // The object may or may not be inside the smoke. If it is inside then
         // less smoke has been travelled through.
         float smoke_dist = std::min(dist_to_obj, max_smoke_dist);
@@ -55,14 +61,14 @@ public:
     }
 
     // return: the specular color, as smoke is not currently affected by shadows.
-    vec3 shadowed_color(vec4 position, const Primitive *smoke_prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec3 shadowed_color(vec4 position, const Primitive *smoke_prim, const Object *smoke_obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         if (!incoming.can_bounce()) {
             return vec3(0, 0, 0);
         }
-        return this->color(position, smoke_prim, incoming, scene, light, num_shadow_rays);
+        return this->color(position, smoke_prim, smoke_obj, incoming, scene, light, num_shadow_rays);
     }
 
-    float transparency(vec4 position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const {
+    float transparency(vec4 position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const {
         return 1.0f;
     }
 
@@ -73,8 +79,8 @@ private:
     // return: The distance the ray travels in the smoke before exiting.
     float max_distance_in_smoke(const vec4 position, const Object *smoke_obj, const Ray &outgoing, const Scene &scene) const {
         // Only consider primitives that are also part of the smoke object.
-        auto is_excluded_prim = [=](const Primitive *testing_prim) {
-            return testing_prim->parent_obj != smoke_obj;
+        auto is_excluded_prim = [=](const Primitive*, const Object *testing_obj) {
+            return testing_obj != smoke_obj;
         };
         optional<Intersection> smoke_exit = scene.closest_intersection(outgoing, is_excluded_prim);
 
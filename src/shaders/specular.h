@@ -13,9 +13,9 @@ public:
     }
 
     // return: the color of the object given the normalised indicent ray.
-    virtual vec3 specular_color(vec4 position, const Primitive *prim, const vec4 shadow_ray_dir, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const = 0;
+    virtual vec3 specular_color(vec4 position, const Primitive *prim, const Object *obj, const vec4 shadow_ray_dir, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const = 0;
 
-    vec3 color(vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
+    vec3 color(vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const override {
         optional<Ray> shadow_ray = light.ray_from(position);
 
         // If the light does not have a notion of position, return black.
@@ -23,7 +23,12 @@ public:
             return vec3(0.0f, 0.0f, 0.0f);
         }
 
-        vec4 shadow_ray_dir = shadow_ray.value().normalized_dir;
-        return this->specular_color(position, prim, shadow_ray_dir, incoming, scene, light, num_shadow_rays);
+        vec4 shadow_ray_dir = vec4(shadow_ray.value().normalized_dir(), 0.0f);
+        return this->specular_color(position, prim, obj, shadow_ray_dir, incoming, scene, light, num_shadow_rays);
+    }
+
+    // return: true, as light cannot pass through a specular surface.
+    bool is_opaque() const override {
+        return true;
     }
 };
@@ -34,7 +34,7 @@ public:
     }
 
     // return: the color of the volume by performing ray marching though the object.
-    vec3 shadowed_color(const vec4 position, const Primitive *prim, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec3 shadowed_color(const vec4 position, const Primitive *prim, const Object *obj, const Ray &incoming, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         // References:
         //  - http://patapom.com/topics/Revision2013/Revision%202013%20-%20Real-time%20Volumetric%20Rendering%20Course%20Notes.pdf
         //  - http://shaderbits.com/blog/creating-volumetric-ray-marcher
@@ -48,14 +48,14 @@ public:
         // This is offset from the initial intersection position, since we
         // cannot exclude this primitive from the search, e.g. for spheres.
         const float offset_dist = this->primary_ray_step_size * this->offset_multipler;
-        Ray through_vol_ray = Ray(position, incoming.dir, incoming.bounces_remaining - 1)
-                             .offset(prim->normal_at(position), offset_dist);
+        Ray through_vol_ray = Ray(vec3(position), incoming.dir, incoming.bounces_remaining - 1)
+                             .offset(vec3(obj->normal_at(prim, position)), offset_dist);
 
-        vec4 out_col = this->ray_marched_color(position, through_vol_ray, prim, scene, light, num_shadow_rays);
+        vec4 out_col = this->ray_marched_color(position, through_vol_ray, prim, obj, scene, light, num_shadow_rays);
 
         // Compute the color of the object behind the volume, to mix with the
         // volume color.
-        vec3 background_col = this->color_behind(position, prim, through_vol_ray, scene, light, num_shadow_rays);
+        vec3 background_col = this->color_behind(position, prim, obj, through_vol_ray, scene, light, num_shadow_rays);
 
         return glm::mix(vec3(out_col), background_col, out_col.w);
     }
@@ -66,7 +66,7 @@ private:
     //         Calculated by performs ray marching through the volume to
     //         determine the interior structure. Also computes the lighting for
     //         points inside the volume.
-    vec4 ray_marched_color(vec4 inside_position, Ray through_vol_ray, const Primitive *prim, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec4 ray_marched_color(vec4 inside_position, Ray through_vol_ray, const Primitive *prim, const Object *obj, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         // Start off with full transparency as the light has not yet passed through any volume.
         float extinction = 1.0f;
         // Start with no accumulated color, as the light has not yet passed through any volume.
@@ -74,7 +74,7 @@ private:
 
         auto primary_ray_step = [&](vec4 step_pos, float step_size, float density) {
             extinction *= exp(-this->extinction_coefficient * density * step_size);
-            vec3 light_col = this->mean_random_scattered_light_color(step_pos, prim, scene, light, num_shadow_rays);
+            vec3 light_col = this->mean_random_scattered_light_color(step_pos, prim, obj, scene, light, num_shadow_rays);
             vec3 step_scattering = light_col * step_size;
             out_col += extinction * step_scattering;
 
@@ -83,42 +83,43 @@ private:
         };
 
         // Ray march through the volume.
-        this->for_each_ray_step(inside_position, through_vol_ray, prim, this->primary_ray_step_size, scene, primary_ray_step);
+        this->for_each_ray_step(inside_position, through_vol_ray, prim, obj, this->primary_ray_step_size, scene, primary_ray_step);
 
         return vec4(out_col, extinction);
     }
 
     // return: the mean color of a number of random rays to the light source,
     //         therefore allowing for soft shadows.
-    vec3 mean_random_scattered_light_color(vec4 inside_position, const Primitive *prim, const Scene &scene, const Light &light, const int num_shadow_rays) const {
-        vector<Ray> shadow_rays = light.random_shadow_rays_from(inside_position, num_shadow_rays);
+    vec3 mean_random_scattered_light_color(vec4 inside_position, const Primitive *prim, const Object *obj, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+        ScratchVector<Ray> shadow_rays;
+        light.random_shadow_rays_from(inside_position, num_shadow_rays, *shadow_rays);
 
         // If the light does not support shadows, assume all the light reached
         // the surface.
-        if (shadow_rays.size() == 0) {
+        if (shadow_rays->size() == 0) {
             return light.intensity(inside_position);
         }
 
         // The addition of all light colors from the different light rays.
         vec3 acc_light_col = vec3(0.0f);
 
-        for (Ray shadow_ray: shadow_rays) {
+        for (const Ray &shadow_ray: *shadow_rays) {
             // The how much light reaches the point from outside the volume.
             // Therefore taking whether other objects are occluding the light
             // into account.
-            float outside_transparency = shadow_ray_transparency(inside_position, prim, scene, shadow_ray);
+            float outside_transparency = shadow_ray_transparency(inside_position, prim, obj, scene, shadow_ray);
 
-            acc_light_col += this->scattered_light_color(inside_position, shadow_ray, prim, scene, light) * outside_transparency;
+            acc_light_col += this->scattered_light_color(inside_position, shadow_ray, prim, obj, scene, light) * outside_transparency;
         }
 
         // Calculate the mean by dividing by the number of rays.
-        return acc_light_col / (float)shadow_rays.size();
+        return acc_light_col / (float)shadow_rays->size();
     }
 
     // return: the color of the light at the given position inside the volume.
     //         Takes scattering of the light into account as it goes through
     //         the volume.
-    vec3 scattered_light_color(vec4 inside_position, const Ray &shadow_ray, const Primitive *prim, const Scene &scene, const Light &light) const {
+    vec3 scattered_light_color(vec4 inside_position, const Ray &shadow_ray, const Primitive *prim, const Object *obj, const Scene &scene, const Light &light) const {
         // Find the how much light made it through the volume, starting with
         // full transparency.
         vec3 extinction = vec3(1.0f);
@@ -129,31 +130,44 @@ private:
             return true;
         };
 
-        // Offset the shadow ray to ensure it's inside the volume.
-        Ray offset_shadow_ray = shadow_ray.offset(prim->normal_at(inside_position), this->shadow_ray_step_size * this->offset_multipler);
+        // Offset the shadow ray to ensure it's inside the volume. The ray
+        // still ends at the light, so the marching stops there if the light
+        // is inside the volume.
+        Ray offset_shadow_ray = shadow_ray.offset(vec3(obj->normal_at(prim, inside_position)), this->shadow_ray_step_size * this->offset_multipler);
         // Ray march through the volume.
-        this->for_each_ray_step(inside_position, offset_shadow_ray, prim, this->shadow_ray_step_size, scene, shadow_ray_step);
+        this->for_each_ray_step(inside_position, offset_shadow_ray, prim, obj, this->shadow_ray_step_size, scene, shadow_ray_step);
 
         return light.intensity(inside_position) * extinction * this->scattering_coefficient;
     }
 
     // param f: called for each step and given the position of the step,
-    //          and the step size for that step.
+    //          and the step size for that step. Taken as a template, rather
+    //          than a std::function, so it is not copied to the heap on each
+    //          call.
     // effect: performs ray marching along the ray, running the function f at
-    //         step along the ray until the ray exits the volume or hits an
-    //         object inside the volume.
-    void for_each_ray_step(const vec4 inside_position, const Ray through_vol_ray, const Primitive *prim, const float max_step_size, const Scene &scene, function<bool(vec4, float, float)> f) const {
+    //         step along the ray until the ray exits the volume, hits an
+    //         object inside the volume, or ends, e.g. at a light inside the
+    //         volume.
+    template<typename F>
+    void for_each_ray_step(const vec4 inside_position, const Ray through_vol_ray, const Primitive *prim, const Object *obj, const float max_step_size, const Scene &scene, F f) const {
         // Find where the ray exits the volume, or where the ray hits an object
         // inside the volume. Therefore, we know where to stop ray marching.
         optional<Intersection> termination = scene.closest_intersection(through_vol_ray);
+        COUNT_RAY_STAT(stat_volume_rays, 1);
+
+        // Rays which end, e.g. shadow rays, stop at their end if it is
+        // inside the volume.
+        const bool ray_ends = through_vol_ray.t_max != std::numeric_limits<float>::max();
 
         // The ray never came out of the volume.
-        if (!termination.has_value()) {
+        if (!termination.has_value() && !ray_ends) {
             printf("WARNING: Ray should exit volume, or intersect another object inside\n");
             return;
         }
 
-        const vec4 termination_pos = termination.value().pos;
+        const vec4 termination_pos = termination.has_value()
+            ? termination->pos
+            : project_to_4D(through_vol_ray.at(through_vol_ray.t_max));
         const float max_dist = length(inside_position - termination_pos);
 
         // Defined because we need to perform a final fractional step of any
@@ -165,47 +179,52 @@ private:
         // for time savings.
         bool should_march = true;
 
+        const vec4 step_dir = vec4(through_vol_ray.normalized_dir(), 0.0f);
+
         // Perform ray marching through the volume. Minus the step size from the
         // maximum to avoid the ray going outside the shape.
         for (; dist < max_dist && should_march; dist += max_step_size) {
-            vec4 step_pos = inside_position + through_vol_ray.normalized_dir * dist;
-            float density = this->volume_density(step_pos, prim);
+            vec4 step_pos = inside_position + step_dir * dist;
+            float density = this->volume_density(step_pos, obj);
 
             should_march = f(step_pos, max_step_size, density);
+            COUNT_RAY_STAT(stat_march_steps, 1);
         }
 
         // Fractional step to remove slicing artefacts from objects inside volume.
         float fractional_dist = max_dist - dist;
-        float density = this->volume_density(termination_pos, prim);
+        float density = this->volume_density(termination_pos, obj);
         f(termination_pos, fractional_dist, density);
     }
 
     // return: the density of the volume at the given position in world coordinates.
-    float volume_density(vec4 world_pos, const Primitive *prim) const {
-        vec4 proj = prim->parent_obj->converted_world_to_obj(world_pos);
+    float volume_density(vec4 world_pos, const Object *obj) const {
+        vec4 proj = obj->converted_world_to_obj(world_pos);
         return this->texture->color_at(vec3(proj)).x;
     }
 
     // return: the color of the object behind or inside the volume.
-    vec3 color_behind(vec4 inside_position, const Primitive *prim, const Ray &through_vol_ray, const Scene &scene, const Light &light, const int num_shadow_rays) const {
+    vec3 color_behind(vec4 inside_position, const Primitive *prim, const Object *obj, const Ray &through_vol_ray, const Scene &scene, const Light &light, const int num_shadow_rays) const {
         if (!through_vol_ray.can_bounce()) {
             return vec3(0, 0, 0);
         }
         // The number of bounces is reduced due to this interaction.
-        Ray outgoing_ray = Ray(inside_position, through_vol_ray.dir, through_vol_ray.bounces_remaining - 1);
+        Ray outgoing_ray = Ray(vec3(inside_position), through_vol_ray.dir, through_vol_ray.bounces_remaining - 1);
+        COUNT_RAY_STAT(stat_volume_rays, 1);
+        COUNT_BOUNCE(outgoing_ray.bounces_remaining);
 
-        optional<Intersection> i = scene.closest_intersection(outgoing_ray, prim);
+        optional<Intersection> i = scene.closest_intersection(outgoing_ray, prim, obj);
         if (!i.has_value()) {
             return vec3(0, 0, 0);
         }
 
-        return i->primitive->shader->shadowed_color(i->pos, i->primitive, outgoing_ray, scene, light, num_shadow_rays);
+        return i->primitive->shader->shadowed_color(i->pos, i->primitive, i->object, outgoing_ray, scene, light, num_shadow_rays);
     }
 
     // return: the proportion by which light is let through the
     //         material. The value is the extinction and is calculated by
     //         performing ray marching through the volume.
-    virtual float transparency(vec4 inside_position, const Primitive *prim, const Ray &shadow_ray, const Scene &scene) const {
+    virtual float transparency(vec4 inside_position, const Primitive *prim, const Object *obj, const Ray &shadow_ray, const Scene &scene) const {
         float extinction = 1.0f;
 
         auto ray_step = [&](vec4 step_pos, float step_size, float density) {
@@ -214,9 +233,12 @@ private:
             return extinction >= 0.001f;
         };
 
-        // Offset the shadow ray to ensure it's inside the volume.
-        Ray offset_shadow_ray = Ray(inside_position, shadow_ray.dir, 0).offset(prim->normal_at(inside_position), this->shadow_ray_step_size * this->offset_multipler);
-        this->for_each_ray_step(inside_position, offset_shadow_ray, prim, this->shadow_ray_step_size, scene, ray_step);
+        // Offset the shadow ray to ensure it's inside the volume. It starts
+        // where the shadow ray enters the volume, and still ends at the
+        // light.
+        const vec3 light_pos = shadow_ray.at(shadow_ray.t_max);
+        Ray offset_shadow_ray = Ray(vec3(inside_position), light_pos - vec3(inside_position), 0, 1.0f).offset(vec3(obj->normal_at(prim, inside_position)), this->shadow_ray_step_size * this->offset_multipler);
+        this->for_each_ray_step(inside_position, offset_shadow_ray, prim, obj, this->shadow_ray_step_size, scene, ray_step);
 
         return extinction;
     }
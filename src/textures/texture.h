@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdexcept>
+
 template<typename Vec>
 class Texture {
 public: